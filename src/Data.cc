@@ -1,62 +1,468 @@
 #include "Data.h"
 
-Data::Data(Parameters* apParameters) :
-mpParameters(apParameters) {
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// 2 bit codes, 4 for everything that goes into the mask
+static const uint8_t NT2CODE[256] = {
+	4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4, 4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,
+	4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4, 4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,
+	4,0,4,1,4,4,4,2,4,4,4,4,4,4,4,4, 4,4,4,4,3,4,4,4,4,4,4,4,4,4,4,4,
+	4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4, 4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,
+	4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4, 4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,
+	4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4, 4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,
+	4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4, 4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,
+	4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4, 4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4
+};
+static const char CODE2NT[4] = {'A','C','G','T'};
+static const char CODE2COMPL[4] = {'T','G','C','A'};
+
+PackedSeq::PackedSeq(const string& aSeq):mSize(0) {
+	Assign(aSeq);
 }
 
-void Data::Init(Parameters* apParameters){
-	mpParameters = apParameters;
+void PackedSeq::Clear(){
+	mBases.clear();
+	mMask.clear();
+	mSize = 0;
 }
 
-Data::BEDdataP Data::LoadBEDfile(string filename){
+void PackedSeq::Assign(const string& aSeq){
+	Clear();
+	Append(aSeq);
+}
 
-	Data::BEDdataP myBED = std::make_shared<BEDdataT>();
-	bool valid_input = true;
-	igzstream fin;
-	string line;
+void PackedSeq::Append(char aNt){
+	uint8_t code = NT2CODE[(uint8_t)aNt];
+	if ((mSize & 3) == 0)
+		mBases.push_back(0);
+	if (code < 4) {
+		mBases.back() |= code << ((mSize & 3) << 1);
+	} else if (mMask.size() && mMask.back().pos + mMask.back().len == mSize && mMask.back().nt == aNt) {
+		mMask.back().len++;
+	} else {
+		maskRunS run = {mSize, 1, aNt};
+		mMask.push_back(run);
+	}
+	mSize++;
+}
 
-	fin.open(filename.c_str());
-	if (!fin)
-		throw range_error("ERROR LoadData: Cannot open index data file: " + filename);
-
-	while (!fin.eof() && valid_input) {
-		BEDentryP myEnt = std::make_shared<BEDentryT>();
-		if (fin >> myEnt->SEQ >> myEnt->START >> myEnt->END >> myEnt->NAME >> myEnt->SCORE >> myEnt->STRAND){
-			//cout << "BED " << myEnt->SEQ << "\t" <<  myEnt->START << "\t" <<  myEnt->END << "\t" <<  myEnt->NAME << "\t" <<  myEnt->SCORE << "\t" <<  myEnt->STRAND << endl;
-
-			getline(fin, line);
-			istringstream iss(line,istringstream::in);
-			string col;
-			while (iss >> col) {
-				myEnt->COLS.push_back(col);
+void PackedSeq::Append(const string& aSeq){
+	mBases.reserve((mSize + aSeq.size() + 3) / 4);
+	for (unsigned i = 0; i < aSeq.size(); i++)
+		Append(aSeq[i]);
+}
+
+static inline char UpperNt(char c) {
+	return (c >= 'a' && c <= 'z') ? c - ('a' - 'A') : c;
+}
+
+void PackedSeq::AppendLines(const char* aSeq, uint64_t aLen){
+	mBases.reserve((mSize + aLen + 3) / 4);
+	uint64_t i = 0;
+	while (i < aLen) {
+		// a whole byte of plain bases at once
+		if ((mSize & 3) == 0 && i + 4 <= aLen) {
+			uint8_t c0 = NT2CODE[(uint8_t)UpperNt(aSeq[i])];
+			uint8_t c1 = NT2CODE[(uint8_t)UpperNt(aSeq[i + 1])];
+			uint8_t c2 = NT2CODE[(uint8_t)UpperNt(aSeq[i + 2])];
+			uint8_t c3 = NT2CODE[(uint8_t)UpperNt(aSeq[i + 3])];
+			if ((c0 | c1 | c2 | c3) < 4) {
+				mBases.push_back(c0 | (c1 << 2) | (c2 << 4) | (c3 << 6));
+				mSize += 4;
+				i += 4;
+				continue;
 			}
-			myBED->insert(make_pair(myEnt->SEQ,myEnt));
 		}
+		char c = aSeq[i++];
+		if (c != '\n' && c != ' ')
+			Append(UpperNt(c));
+	}
+}
+
+vector<PackedSeq::maskRunS>::const_iterator PackedSeq::FirstMaskRun(unsigned aPos) const {
+	// first run that ends behind aPos
+	return std::upper_bound(mMask.begin(), mMask.end(), aPos,
+			[](unsigned p, const maskRunS& r){ return p < r.pos + r.len; });
+}
+
+void PackedSeq::Unpack(unsigned aPos, unsigned aLen, string& oSeq) const {
+	if (aPos + aLen > mSize)
+		throw range_error("ERROR PackedSeq::Unpack: window outside of sequence " + std::to_string(aPos) + "+" + std::to_string(aLen));
+	oSeq.resize(aLen);
+	for (unsigned i = 0; i < aLen; i++) {
+		unsigned p = aPos + i;
+		oSeq[i] = CODE2NT[(mBases[p >> 2] >> ((p & 3) << 1)) & 3];
+	}
+	for (auto r = FirstMaskRun(aPos); r != mMask.end() && r->pos < aPos + aLen; ++r) {
+		unsigned first = max(r->pos, aPos);
+		unsigned last = min(r->pos + r->len, aPos + aLen);
+		for (unsigned p = first; p < last; p++)
+			oSeq[p - aPos] = r->nt;
+	}
+}
+
+void PackedSeq::UnpackRevCompl(unsigned aPos, unsigned aLen, string& oSeq) const {
+	if (aPos + aLen > mSize)
+		throw range_error("ERROR PackedSeq::UnpackRevCompl: window outside of sequence " + std::to_string(aPos) + "+" + std::to_string(aLen));
+	oSeq.resize(aLen);
+	const unsigned last = aPos + aLen - 1;
+	for (unsigned i = 0; i < aLen; i++) {
+		unsigned p = last - i;
+		oSeq[i] = CODE2COMPL[(mBases[p >> 2] >> ((p & 3) << 1)) & 3];
+	}
+	for (auto r = FirstMaskRun(aPos); r != mMask.end() && r->pos <= last; ++r) {
+		unsigned first = max(r->pos, aPos);
+		unsigned end = min(r->pos + r->len, aPos + aLen);
+		for (unsigned p = first; p < end; p++)
+			oSeq[last - p] = 'N';
+	}
+}
+
+string PackedSeq::Substr(unsigned aPos, unsigned aLen) const {
+	string seq;
+	Unpack(aPos, aLen, seq);
+	return seq;
+}
+
+bool MappedFasta::Open(const string& aFileName, uint64_t aBegin, uint64_t aEnd) {
+	Close();
+	if (aFileName == "-")
+		return false;
+	int fd = open(aFileName.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+		close(fd);
+		return false;
+	}
+	mSize = st.st_size;
+	if (mSize > 0) {
+		void* p = mmap(NULL, mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p == MAP_FAILED) {
+			close(fd);
+			mSize = 0;
+			return false;
+		}
+		mData = (const char*) p;
+		madvise(p, mSize, MADV_SEQUENTIAL);
+	}
+	close(fd);
+	if (mSize >= 2 && (uint8_t) mData[0] == 0x1f && (uint8_t) mData[1] == 0x8b) {
+		Close();
+		return false;
+	}
+	mEnd = aEnd > 0 ? std::min(aEnd, mSize) : mSize;
+	mPos = std::min(aBegin, mEnd);
+	mEof = false;
+	return true;
+}
+
+void MappedFasta::Close() {
+	if (mData)
+		munmap((void*) mData, mSize);
+	mData = NULL;
+	mSize = mPos = mEnd = 0;
+	mEof = true;
+}
+
+// next '>' at a line start from aFrom on, or the end of the range
+uint64_t MappedFasta::FindRecordEnd(uint64_t aFrom) const {
+	uint64_t p = aFrom;
+#if defined(__SSE2__)
+	const __m128i gt = _mm_set1_epi8('>');
+	for (; p + 16 <= mEnd; p += 16) {
+		unsigned hits = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (mData + p)), gt));
+		for (; hits; hits &= hits - 1) {
+			uint64_t q = p + __builtin_ctz(hits);
+			if (mData[q - 1] == '\n')
+				return q;
+		}
+	}
+#endif
+	for (; p < mEnd; p++)
+		if (mData[p] == '>' && mData[p - 1] == '\n')
+			return p;
+	return mEnd;
+}
+
+bool MappedFasta::Next(PackedSeq& oSeq, string& oHeader) {
+
+	oSeq.Clear();
+	oHeader.clear();
+	while (mPos < mEnd && isspace((unsigned char) mData[mPos]))
+		mPos++;
+	if (mPos >= mEnd) {
+		mEof = true;
+		return false;
+	}
+	if (mData[mPos] != '>')
+		throw range_error("ERROR FASTA format error  -2-!");
+
+	const char* line = mData + mPos + 1;
+	const char* eol = (const char*) memchr(line, '\n', mEnd - mPos - 1);
+	uint64_t seqBegin = eol ? eol - mData + 1 : mEnd;
+	const char* blank = (const char*) memchr(line, ' ', (eol ? eol : mData + mEnd) - line);
+	oHeader.assign(line, (blank ? blank : eol ? eol : mData + mEnd) - line);
+
+	uint64_t seqEnd = seqBegin < mEnd ? FindRecordEnd(seqBegin) : mEnd;
+	oSeq.AppendLines(mData + seqBegin, seqEnd - seqBegin);
+	mPos = seqEnd;
+	if (oSeq.Size()==0 || oHeader.size()==0)
+		throw range_error("ERROR FASTA reader - empty Sequence or header found! Header:"+oHeader);
+	return true;
+}
+
+// next blank separated column of a BED line, false at the end of the line
+static bool NextBedToken(const char*& aPos, const char* aEnd, const char*& oTok, unsigned& oLen) {
+	while (aPos < aEnd && (*aPos == '\t' || *aPos == ' ' || *aPos == '\r'))
+		aPos++;
+	if (aPos == aEnd)
+		return false;
+	oTok = aPos;
+	while (aPos < aEnd && *aPos != '\t' && *aPos != ' ' && *aPos != '\r')
+		aPos++;
+	oLen = aPos - oTok;
+	return true;
+}
+
+static bool ParseBedCoord(const char* aTok, unsigned aLen, unsigned& oVal) {
+	uint64_t val = 0;
+	for (unsigned i = 0; i < aLen; i++) {
+		if (aTok[i] < '0' || aTok[i] > '9')
+			return false;
+		val = val * 10 + (aTok[i] - '0');
+		if (val > std::numeric_limits<unsigned>::max())
+			return false;
+	}
+	oVal = val;
+	return aLen > 0;
+}
+
+template<class T>
+static void PermuteBed(vector<T>& aCol, const vector<unsigned>& aOrder) {
+	vector<T> sorted(aOrder.size());
+	for (unsigned i = 0; i < aOrder.size(); i++)
+		sorted[i] = aCol[aOrder[i]];
+	aCol.swap(sorted);
+}
+
+void BedTable::Load(const string& aFileName) {
+
+	igzstream fin;
+	fin.open(aFileName.c_str());
+	if (!fin)
+		throw range_error("ERROR LoadData: Cannot open index data file: " + aFileName);
+
+	// read in blocks and split into lines by hand, a partial last line moves to the front for the next block
+	const size_t blockSize = 1 << 20;
+	string buf;
+	size_t used = 0;
+	uint64_t lineNum = 0;
+	bool eof = false;
+	while (!eof) {
+		buf.erase(0, used);
+		size_t keep = buf.size();
+		buf.resize(keep + blockSize);
+		fin.read(&buf[keep], blockSize);
+		buf.resize(keep + fin.gcount());
+		eof = fin.gcount() == 0;
+		if (eof && keep)
+			buf.push_back('\n');
+
+		const char* data = buf.data();
+		const char* end = data + buf.size();
+		const char* line = data;
+		const char* eol;
+		while ((eol = (const char*) memchr(line, '\n', end - line)) != NULL) {
+			AddLine(line, eol, ++lineNum, aFileName);
+			line = eol + 1;
+		}
+		used = line - data;
 	}
 	fin.close();
-	cout << "BED file loaded with " <<  myBED->size() << " entries" << endl;
-	if (!myBED->size())
+	SortBySeq();
+}
+
+void BedTable::AddLine(const char* aLine, const char* aEnd, uint64_t aLineNum, const string& aFileName) {
+
+	const char* tok[6];
+	unsigned len[6];
+	unsigned n = 0;
+	const char* pos = aLine;
+	while (n < 6 && NextBedToken(pos, aEnd, tok[n], len[n]))
+		n++;
+	// empty, comment and track/browser lines
+	if (n == 0 || tok[0][0] == '#' || (len[0] == 5 && !strncmp(tok[0], "track", 5)) || (len[0] == 7 && !strncmp(tok[0], "browser", 7)))
+		return;
+
+	unsigned start, end;
+	if (n < 3 || !ParseBedCoord(tok[1], len[1], start) || !ParseBedCoord(tok[2], len[2], end))
+		throw range_error("ERROR BedTable::Load: No valid BED entry in line " + std::to_string(aLineNum) + " of " + aFileName);
+
+	mSeq.push_back(Intern(tok[0], len[0]));
+	mStart.push_back(start);
+	mEnd.push_back(end);
+	mName.push_back(n > 3 ? Intern(tok[3], len[3]) : Intern("", 0));
+	// "." is no score
+	mScore.push_back(n > 4 && !(len[4] == 1 && tok[4][0] == '.') ? strtof(tok[4], NULL) : 0);
+	mStrand.push_back(n > 5 ? tok[5][0] : '.');
+	const char* col;
+	unsigned colLen;
+	while (NextBedToken(pos, aEnd, col, colLen))
+		mCols.push_back(Intern(col, colLen));
+	mColsBegin.push_back(mCols.size());
+}
+
+unsigned BedTable::Add(const string& aSeq, unsigned aStart, unsigned aEnd, const string& aName, float aScore, char aStrand, const vector<string>& aCols) {
+	mSeq.push_back(Intern(aSeq.data(), aSeq.size()));
+	mStart.push_back(aStart);
+	mEnd.push_back(aEnd);
+	mName.push_back(Intern(aName.data(), aName.size()));
+	mScore.push_back(aScore);
+	mStrand.push_back(aStrand);
+	for (unsigned k = 0; k < aCols.size(); k++)
+		mCols.push_back(Intern(aCols[k].data(), aCols[k].size()));
+	mColsBegin.push_back(mCols.size());
+	return Size() - 1;
+}
+
+static inline unsigned HashBedString(const char* aStr, unsigned aLen) {
+	// FNV-1a
+	unsigned h = 2166136261u;
+	for (unsigned i = 0; i < aLen; i++)
+		h = (h ^ (uint8_t) aStr[i]) * 16777619u;
+	return h;
+}
+
+unsigned BedTable::Intern(const char* aStr, unsigned aLen) {
+	if (2 * (mStrings.size() + 1) > mSlots.size())
+		Rehash(std::max((size_t) 1024, 2 * mSlots.size()));
+	unsigned mask = mSlots.size() - 1;
+	for (unsigned slot = HashBedString(aStr, aLen) & mask;; slot = (slot + 1) & mask) {
+		if (!mSlots[slot]) {
+			mStrings.push_back(string(aStr, aLen));
+			mSlots[slot] = mStrings.size();
+			return mStrings.size() - 1;
+		}
+		const string& str = mStrings[mSlots[slot] - 1];
+		if (str.size() == aLen && !memcmp(str.data(), aStr, aLen))
+			return mSlots[slot] - 1;
+	}
+}
+
+void BedTable::Rehash(unsigned aNumSlots) {
+	mSlots.assign(aNumSlots, 0);
+	unsigned mask = aNumSlots - 1;
+	for (unsigned id = 0; id < mStrings.size(); id++) {
+		unsigned slot = HashBedString(mStrings[id].data(), mStrings[id].size()) & mask;
+		while (mSlots[slot])
+			slot = (slot + 1) & mask;
+		mSlots[slot] = id + 1;
+	}
+}
+
+bool BedTable::Find(const string& aSeqName, unsigned& oFirst, unsigned& oLast) const {
+	SeqRangesT::const_iterator it = mSeqRanges.find(aSeqName);
+	if (it == mSeqRanges.end())
+		return false;
+	oFirst = it->second.first;
+	oLast = it->second.second;
+	return true;
+}
+
+// stable counting sort of all entries by the rank of their seq name
+void BedTable::SortBySeq() {
+
+	unsigned size = Size();
+	vector<unsigned> rank(mStrings.size(), 0);
+	vector<unsigned> seqs;
+	for (unsigned i = 0; i < size; i++) {
+		if (!rank[mSeq[i]]) {
+			rank[mSeq[i]] = 1;
+			seqs.push_back(mSeq[i]);
+		}
+	}
+	std::sort(seqs.begin(), seqs.end(), [this](unsigned a, unsigned b) { return mStrings[a] < mStrings[b]; });
+
+	vector<unsigned> begin(seqs.size() + 1, 0);
+	for (unsigned k = 0; k < seqs.size(); k++)
+		rank[seqs[k]] = k;
+	for (unsigned i = 0; i < size; i++)
+		begin[rank[mSeq[i]] + 1]++;
+	std::partial_sum(begin.begin(), begin.end(), begin.begin());
+	mSeqRanges.clear();
+	for (unsigned k = 0; k < seqs.size(); k++)
+		mSeqRanges.insert(make_pair(mStrings[seqs[k]], make_pair(begin[k], begin[k + 1])));
+
+	vector<unsigned> order(size);
+	for (unsigned i = 0; i < size; i++)
+		order[begin[rank[mSeq[i]]]++] = i;
+
+	PermuteBed(mSeq, order);
+	PermuteBed(mStart, order);
+	PermuteBed(mEnd, order);
+	PermuteBed(mName, order);
+	PermuteBed(mScore, order);
+	PermuteBed(mStrand, order);
+	vector<unsigned> colsBegin(1, 0);
+	vector<unsigned> cols;
+	cols.reserve(mCols.size());
+	for (unsigned i = 0; i < size; i++) {
+		cols.insert(cols.end(), mCols.begin() + mColsBegin[order[i]], mCols.begin() + mColsBegin[order[i] + 1]);
+		colsBegin.push_back(cols.size());
+	}
+	mCols.swap(cols);
+	mColsBegin.swap(colsBegin);
+}
+
+Data::Data(Parameters* apParameters) :
+mpParameters(apParameters) {
+}
+
+void Data::Init(Parameters* apParameters){
+	mpParameters = apParameters;
+}
+
+Data::BEDdataP Data::LoadBEDfile(string filename){
+
+	Data::BEDdataP myBED = std::make_shared<BedTable>();
+	myBED->Load(filename);
+	cout << "BED file loaded with " <<  myBED->Size() << " entries" << endl;
+	if (!myBED->Size())
 		throw range_error("ERROR LoadIndexData: No data found in " + filename + "!");
 
 	return myBED;
 }
 
-
-void Data::GetNextFastaSeq(istream& in,string& currSeq, string& header) {
+void Data::GetNextFastaSeq(istream& in,PackedSeq& currSeq, string& header) {
 
 	in >> std::ws;
 
 	char c = in.peek();
-	currSeq.clear();
+	currSeq.Clear();
 	header.clear();
 
 	if (!in.eof() && c != EOF && c=='>' ){
-		getline(in, header,'>');
+		in.get();
 		getline(in, header);
-		getline(in, currSeq,'>');
-		currSeq.erase(std::remove(currSeq.begin(), currSeq.end(), '\n'),currSeq.end());
-		currSeq.erase(std::remove(currSeq.begin(), currSeq.end(), ' '),currSeq.end());
-		std::transform(currSeq.begin(), currSeq.end(), currSeq.begin(), ::toupper);
+		// sequence lines up to the next header, packed while reading
+		std::streambuf* sb = in.rdbuf();
+		string line;
+		while (sb->sgetc() != EOF && sb->sgetc() != '>') {
+			getline(in, line);
+			for (unsigned i = 0; i < line.size(); i++) {
+				if (line[i] != ' ')
+					currSeq.Append(::toupper(line[i]));
+			}
+		}
+		// the last line of the file may have set eof, but this record still has to be processed
+		in.clear(in.rdstate() & ~std::ios::eofbit);
 
 		//string seq = currSeq.substr(mpParameters->mSeqClip,currSeq.size()-(2*mpParameters->mSeqClip));
 		//currSeq=seq;
@@ -64,49 +470,49 @@ void Data::GetNextFastaSeq(istream& in,string& currSeq, string& header) {
 		const unsigned pos = header.find_first_of(" ");
 		if (std::string::npos != pos)
 			header = header.substr(0,pos);
-		in.unget();
-		if (currSeq.size()==0 || header.size()==0)
+		if (currSeq.Size()==0 || header.size()==0)
 			throw range_error("ERROR FASTA reader - empty Sequence or header found! Header:"+header);
-		//cout << " found seq " << header << " " << currSeq.size() << " length" << " EOF? "<< in.eof() << endl;
+		//cout << " found seq " << header << " " << currSeq.Size() << " length" << " EOF? "<< in.eof() << endl;
 	} else if (c != '>' && c != EOF && c!= '\n') {
 		throw range_error("ERROR FASTA format error  -2-!");
 	}
 }
 
-bool Data::GetNextWinFromSeq(string& currSeq, unsigned& pos, bool& lastGr, string& seq) {
+bool Data::GetNextWinFromSeq(unsigned& currSeqSize, unsigned& pos, bool& lastGr, unsigned& winPos, unsigned& winSize) {
 
 	bool success_status = false;
 	lastGr = false;
+	winSize = 0;
 	unsigned win=mpParameters->mSeqWindow;
 	unsigned shift = std::max((double)1,(double)win*mpParameters->mSeqShift);
 
-	if (currSeq.size() > pos ) {
+	if (currSeqSize > pos ) {
 
 		// default case for window/shift
 		unsigned currSize = win;
 		// case no window/shift
 		if (win==0){
 			unsigned clipSize = mpParameters->mSeqClip;
-			currSize = currSeq.size()-(2*clipSize);
+			currSize = currSeqSize-(2*clipSize);
 			pos = clipSize;
-		} else if (win>currSeq.size()-pos) {
+		} else if (win>currSeqSize-pos) {
 			// case seq left is smaller than win
 			// then we take a full window from the end
-			pos = std::max((int)0,((int)currSeq.size()-(int)win));
-			currSize=currSeq.size()-pos;
+			pos = std::max((int)0,((int)currSeqSize-(int)win));
+			currSize=currSeqSize-pos;
 		}
 
 		if (currSize>=1){
-			seq = currSeq.substr(pos,currSize);
-			//SetGraphFromSeq( seq ,oG);
-			//cout << currSeq.size() << " " << currSize  << " pos " << pos << " win " << win << " " << seq << endl;
+			winPos = pos;
+			winSize = currSize;
+			//cout << currSeqSize << " " << currSize  << " pos " << pos << " win " << win << endl;
 		} else
 			throw range_error("ERROR FASTA reader! Too short sequence found. " + std::to_string(pos));
 
-		if ((win>0) && (currSeq.size()-pos-shift>=win)){
+		if ((win>0) && (currSeqSize-pos-shift>=win)){
 			pos += shift;
-		} else if ((currSeq.size()-shift-pos<win ) || (win == 0))	{
-			currSeq="";
+		} else if ((currSeqSize-shift-pos<win ) || (win == 0))	{
+			currSeqSize = 0;
 			pos = 0;
 			lastGr=true;
 		}
@@ -157,10 +563,142 @@ void Data::GetRevComplSeq(string& in_seq,string& out_seq){
 	}
 }
 
-void Data::GetNextStringSeq(istream& in,string& currSeq) {
+// one 4 line FASTQ record; with min_quality the low quality bases are read as N (quality_mode MASK)
+// or cut from both ends (TRIM), oLowQual gets the runs of low quality bases that are left
+void Data::GetNextFastqSeq(istream& in,PackedSeq& currSeq, string& header, RegionsT& oLowQual) {
+
+	in >> std::ws;
+
+	char c = in.peek();
+	currSeq.Clear();
+	header.clear();
+	oLowQual.clear();
+
+	if (in.eof() || c == EOF)
+		return;
+	if (c != '@')
+		throw range_error("ERROR FASTQ format error, record does not start with @");
+
+	static thread_local string seq, plus, qual;
+	in.get();
+	getline(in, header);
+	getline(in, seq);
+	getline(in, plus);
+	getline(in, qual);
+	// the last line of the file may have set eof, but this record still has to be processed
+	in.clear(in.rdstate() & ~std::ios::eofbit);
+	for (string* line : {&header, &seq, &plus, &qual})
+		if (line->size() && line->back() == '\r')
+			line->pop_back();
+
+	const unsigned pos = header.find_first_of(" ");
+	if (std::string::npos != pos)
+		header = header.substr(0,pos);
+	if (seq.size()==0 || header.size()==0)
+		throw range_error("ERROR FASTQ reader - empty Sequence or header found! Header:"+header);
+	if (plus.size()==0 || plus[0] != '+' || qual.size() != seq.size())
+		throw range_error("ERROR FASTQ format error, quality line does not match the sequence! Header:"+header);
+
+	unsigned first = 0, last = seq.size();
+	if (mpParameters->mMinQuality > 0) {
+		const char minQual = 33 + std::min(mpParameters->mMinQuality, 93u);
+		if (mpParameters->mQualityModeCode == QUALITY_TRIM) {
+			while (first < last && qual[first] < minQual)
+				first++;
+			while (last > first && qual[last - 1] < minQual)
+				last--;
+		}
+		for (unsigned i = first; i < last; i++) {
+			if (qual[i] >= minQual)
+				continue;
+			if (mpParameters->mQualityModeCode == QUALITY_MASK)
+				seq[i] = 'N';
+			if (oLowQual.size() && oLowQual.back().second == i - first)
+				oLowQual.back().second++;
+			else
+				oLowQual.push_back(make_pair(i - first, i - first + 1));
+		}
+	}
+	currSeq.AppendLines(seq.data() + first, last - first);
+}
+
+// true if [aPos,aPos+aLen) lies completely in one of the regions
+bool Data::InRegion(const RegionsT& aRegions, unsigned aPos, unsigned aLen) {
+	RegionsT::const_iterator r = std::upper_bound(aRegions.begin(), aRegions.end(), make_pair(aPos, std::numeric_limits<unsigned>::max()));
+	return r != aRegions.begin() && (--r)->first <= aPos && aPos + aLen <= r->second;
+}
+
+void Data::GetNextStringSeq(istream& in,PackedSeq& currSeq) {
+
+	string line;
+	getline(in, line);
+	currSeq.Assign(line);
+}
+
+// false for stdin ("-") and pipes, which can only be read once
+bool Data::IsRegularFile(string aFileName) {
+	struct stat st;
+	return aFileName != "-" && stat(aFileName.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+}
+
+bool Data::IsGzipFile(string aFileName) {
+	ifstream fin(aFileName.c_str(), std::ios::in | std::ios::binary);
+	return fin.get() == 0x1f && fin.get() == 0x8b;
+}
+
+// byte offsets of at most aNumParts parts of a FASTA file, every part starts with a header line;
+// oBounds holds the start of each part followed by the file size
+void Data::SplitFastaFile(string aFileName, unsigned aNumParts, vector<uint64_t>& oBounds) {
+
+	oBounds.clear();
+	ifstream fin(aFileName.c_str(), std::ios::in | std::ios::binary);
+	if (!fin)
+		throw range_error("ERROR Data::SplitFastaFile: Cannot open file: " + aFileName);
+	fin.seekg(0, std::ios::end);
+	uint64_t size = fin.tellg();
+
+	oBounds.push_back(0);
+	for (unsigned k = 1; k < aNumParts; k++) {
+		uint64_t pos = std::max(size * k / aNumParts, oBounds.back() + 1);
+		if (pos >= size)
+			break;
+		// next line start with a header at or after pos
+		fin.clear();
+		fin.seekg(pos - 1);
+		int prev = fin.get();
+		int c;
+		while ((c = fin.get()) != EOF && !(prev == '\n' && c == '>')) {
+			prev = c;
+			pos++;
+		}
+		if (c == EOF)
+			break;
+		oBounds.push_back(pos);
+	}
+	oBounds.push_back(size);
+}
+
+// sequence names of all records of a FASTA file in file order, as returned by GetNextFastaSeq
+void Data::LoadFastaNames(string aFileName, vector<string>& oNames) {
 
-	currSeq.clear();
-	getline(in, currSeq);
+	oNames.clear();
+	igzstream fin;
+	fin.open(aFileName.c_str(), std::ios::in);
+	if (!fin)
+		throw range_error("ERROR Data::LoadFastaNames: Cannot open file: " + aFileName);
+	string header;
+	while (fin >> std::ws && fin.peek() != EOF) {
+		if (fin.peek() == '>') {
+			fin.get();
+			getline(fin, header);
+			const unsigned pos = header.find_first_of(" ");
+			if (std::string::npos != pos)
+				header = header.substr(0, pos);
+			oNames.push_back(header);
+		} else
+			fin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+	}
+	fin.close();
 }
 
 
@@ -9,26 +9,123 @@
 
 using namespace std;
 
-class Data {
+// nucleotide sequence stored with 2 bits per base (A,C,G,T); all other
+// characters (N, IUPAC codes, lower case, ...) are kept as runs in a side mask
+class PackedSeq {
 
 public:
+	PackedSeq():mSize(0) {};
+	PackedSeq(const string& aSeq);
+
+	void		Clear();
+	void		Assign(const string& aSeq);
+	void		Append(char aNt);
+	void		Append(const string& aSeq);
+	// sequence lines as they are in a FASTA file: line breaks and blanks are dropped, lower case is upper case
+	void		AppendLines(const char* aSeq, uint64_t aLen);
+	unsigned	Size() const { return mSize; };
 
-	struct BEDentryS {
-		// cols 1-6 from file
-		string SEQ;
-		uint START;
-		uint END;
-		string NAME;
-		double SCORE;
-		char	STRAND;
-		// col7 and beyond
-		vector<string> COLS;
+	// copy bases [aPos,aPos+aLen) into oSeq, resp. their reverse complement;
+	// the reverse complement maps all masked characters to N
+	void		Unpack(unsigned aPos, unsigned aLen, string& oSeq) const;
+	void		UnpackRevCompl(unsigned aPos, unsigned aLen, string& oSeq) const;
+	string	Substr(unsigned aPos, unsigned aLen) const;
+
+private:
+	struct maskRunS {
+		unsigned	pos;
+		unsigned	len;
+		char		nt;
 	};
-	typedef BEDentryS BEDentryT;
-	typedef std::shared_ptr<BEDentryS> BEDentryP;
-	typedef multimap<string, BEDentryP> BEDdataT;
-	typedef BEDdataT::iterator BEDdataIt;
-	typedef std::shared_ptr<BEDdataT> BEDdataP;
+
+	vector<uint8_t>	mBases;	// 4 bases per byte, base i in bits 2*(i%4)
+	vector<maskRunS>	mMask;	// runs of non ACGT characters, sorted by pos
+	unsigned				mSize;
+
+	vector<maskRunS>::const_iterator	FirstMaskRun(unsigned aPos) const;
+};
+
+typedef std::shared_ptr<PackedSeq> PackedSeqP;
+
+// uncompressed FASTA file, or the byte range of a split file, mapped into memory; the records
+// are found by a SIMD scan for '>' at line starts and their bases packed straight from the mapping
+class MappedFasta {
+
+public:
+	MappedFasta():mData(NULL),mSize(0),mPos(0),mEnd(0),mEof(true) {};
+	MappedFasta(const MappedFasta&) = delete;
+	~MappedFasta() { Close(); };
+
+	// false if the file cannot be mapped (stdin, pipes, gzip files), it has to be read as a stream then
+	bool	Open(const string& aFileName, uint64_t aBegin = 0, uint64_t aEnd = 0);
+	void	Close();
+	// same records as Data::GetNextFastaSeq, false at the end of the range
+	bool	Next(PackedSeq& oSeq, string& oHeader);
+	bool	Eof() const { return mEof; };
+
+private:
+	const char*	mData;
+	uint64_t		mSize;
+	uint64_t		mPos;
+	uint64_t		mEnd;
+	bool			mEof;
+
+	uint64_t	FindRecordEnd(uint64_t aFrom) const;
+};
+
+// BED annotation stored by columns: all names and extra columns are interned strings, the
+// entries of a sequence are one contiguous range [first,last) in file order, ranges sorted by sequence name
+class BedTable {
+
+public:
+	BedTable() { mColsBegin.push_back(0); };
+
+	void		Load(const string& aFileName);
+	// entry that is not found by its sequence name, e.g. a placeholder for a feature without annotation
+	unsigned	Add(const string& aSeq, unsigned aStart, unsigned aEnd, const string& aName, float aScore, char aStrand, const vector<string>& aCols);
+	unsigned	Size() const { return mStart.size(); };
+	// false if there is no entry for the sequence
+	bool		Find(const string& aSeqName, unsigned& oFirst, unsigned& oLast) const;
+
+	// cols 1-6
+	const string&	Seq(unsigned i) const { return mStrings[mSeq[i]]; };
+	unsigned		Start(unsigned i) const { return mStart[i]; };
+	unsigned		End(unsigned i) const { return mEnd[i]; };
+	const string&	Name(unsigned i) const { return mStrings[mName[i]]; };
+	float			Score(unsigned i) const { return mScore[i]; };
+	char			Strand(unsigned i) const { return mStrand[i]; };
+	// col7 and beyond
+	unsigned		NumCols(unsigned i) const { return mColsBegin[i+1] - mColsBegin[i]; };
+	const string&	Col(unsigned i, unsigned k) const { return mStrings[mCols[mColsBegin[i] + k]]; };
+
+private:
+	typedef std::tr1::unordered_map<string, pair<unsigned,unsigned> > SeqRangesT;
+
+	vector<string>		mStrings;	// interned strings by id
+	vector<unsigned>	mSlots;		// open addressing hash table of id+1, 0 is a free slot
+	vector<unsigned>	mSeq;
+	vector<unsigned>	mStart;
+	vector<unsigned>	mEnd;
+	vector<unsigned>	mName;
+	vector<float>		mScore;
+	vector<char>		mStrand;
+	vector<unsigned>	mColsBegin;	// cols of entry i are mCols[mColsBegin[i],mColsBegin[i+1])
+	vector<unsigned>	mCols;
+	SeqRangesT			mSeqRanges;
+
+	unsigned	Intern(const char* aStr, unsigned aLen);
+	void		Rehash(unsigned aNumSlots);
+	void		AddLine(const char* aLine, const char* aEnd, uint64_t aLineNum, const string& aFileName);
+	void		SortBySeq();
+};
+
+class Data {
+
+public:
+
+	typedef std::shared_ptr<BedTable> BEDdataP;
+	// [begin,end) ranges of a sequence, sorted
+	typedef vector<pair<unsigned,unsigned> > RegionsT;
 
 
 	Parameters* mpParameters;
@@ -40,12 +137,18 @@ public:
 	void Init(Parameters* apParameters);
 
 	BEDdataP	LoadBEDfile(string filename);
-	bool GetNextWinFromSeq(string& currSeq, unsigned& pos, bool& lastGr, string& seq);
+	bool GetNextWinFromSeq(unsigned& currSeqSize, unsigned& pos, bool& lastGr, unsigned& winPos, unsigned& winSize);
 	//bool SetGraphFromSeq2(GraphClass& oG, string& currSeq, unsigned& pos, bool& lastGr, string& seq);
 	//bool SetGraphFromSeq(string& seq, GraphClass& oG);
 	void GetRevComplSeq(string& in_seq,string& out_seq);
-	void GetNextFastaSeq(istream& in,string& currSeq, string& header);
-	void GetNextStringSeq(istream& in,string& currSeq);
+	void GetNextFastaSeq(istream& in,PackedSeq& currSeq, string& header);
+	void GetNextFastqSeq(istream& in,PackedSeq& currSeq, string& header, RegionsT& oLowQual);
+	void GetNextStringSeq(istream& in,PackedSeq& currSeq);
+	bool InRegion(const RegionsT& aRegions, unsigned aPos, unsigned aLen);
+	bool IsGzipFile(string aFileName);
+	bool IsRegularFile(string aFileName);
+	void SplitFastaFile(string aFileName, unsigned aNumParts, vector<uint64_t>& oBounds);
+	void LoadFastaNames(string aFileName, vector<string>& oNames);
 	void LoadStringList(string aFileName, vector<string>& oList, uint numTokens);
 
 	//	vector<SeqDataSet> LoadIndexDataList(string filename);
@@ -6,6 +6,7 @@ MinHashEncoder::~MinHashEncoder(){
 }
 
 MinHashEncoder::MinHashEncoder(Parameters* apParameters, Data* apData)
+	:mTasks(apParameters->mNumThreads), mInflateThreads(1), mStatsRuns(0), mStatsIdle(0)
 {
 	Init(apParameters, apData);
 }
@@ -18,9 +19,16 @@ void MinHashEncoder::Init(Parameters* apParameters, Data* apData) {
 	mHashBitMask = numeric_limits<unsigned>::max() >> 1;
 	mHashBitMask = (2 << (mpParameters->mHashBitSize - 1)) - 1;
 	cout << "hashbitmask "<< mHashBitMask << endl;
+	InitNSPDKKernel();
+	InitPairKernel();
+	InitNuma();
+	// other compressed files (BED, index) are read while the pool is idle
+	pgzstreambuf::maxThreads = mTasks.size();
+	mWorkerBuffers.resize(mTasks.size());
 	if (mpParameters->mNumRepeatsHashFunction == 0 || mpParameters->mNumRepeatsHashFunction > mpParameters->mNumHashShingles * mpParameters->mNumHashFunctions){
 		mpParameters->mNumRepeatsHashFunction = mpParameters->mNumHashShingles * mpParameters->mNumHashFunctions;
 	}
+	mHashFamily.Init(mpParameters->mHashFamilyCode, mpParameters->mNumRepeatsHashFunction, mpParameters->mHashBitSize, mpParameters->mRandomSeed);
 
 	if (mpParameters->mSeqWindow != 0 && mpParameters->mSeqShift == 0){
 		throw range_error("Please provide seq_shift > 0 if seq_window is > 0!");
@@ -28,25 +36,218 @@ void MinHashEncoder::Init(Parameters* apParameters, Data* apData) {
 
 }
 
-inline vector<unsigned> MinHashEncoder::HashFuncNSPDK(const string& aString, unsigned aStart, unsigned aMaxRadius, unsigned aBitMask) {
-	unsigned int hash = 0xAAAAAAAA;
-	unsigned effective_end = min((unsigned) aString.size() - 1, aStart + aMaxRadius);
-	unsigned radius = 0;
-	vector<unsigned> code_list(aMaxRadius + 1, 0);
-	for (std::size_t i = aStart; i <= effective_end; i++) {
-		hash ^= ((i & 1) == 0) ? ((hash << 7) ^ aString[i] * (hash >> 3)) : (~(((hash << 11) + aString[i]) ^ (hash >> 5)));
-		code_list[radius] = hash & aBitMask;
-		radius++;
+// NSPDK neighborhood codes for radius 0..aMaxRadius of all start positions in [aFirst,aLast),
+// written row-wise (aMaxRadius+1 codes per start position, row 0 is position 0) into aCodes.
+// Radii reaching beyond the sequence end have no neighborhood and get code 0.
+// The hash step alternates with the parity of the position in the sequence, or with
+// aRelativeParity of the position in the neighborhood, so that codes depend on the content only.
+static void HashFuncNSPDK_scalar(const char* aSeq, unsigned aSize, unsigned aFirst, unsigned aLast, unsigned aMaxRadius, unsigned aBitMask, bool aRelativeParity, unsigned* aCodes) {
+	const unsigned numCodes = aMaxRadius + 1;
+	for (unsigned start = aFirst; start < aLast; start++) {
+		unsigned* codes = aCodes + start * numCodes;
+		const std::size_t parity = aRelativeParity ? (start & 1) : 0;
+		unsigned int hash = 0xAAAAAAAA;
+		unsigned effective_end = min(aSize - 1, start + aMaxRadius);
+		unsigned radius = 0;
+		for (std::size_t i = start; i <= effective_end; i++) {
+			hash ^= (((i ^ parity) & 1) == 0) ? ((hash << 7) ^ aSeq[i] * (hash >> 3)) : (~(((hash << 11) + aSeq[i]) ^ (hash >> 5)));
+			codes[radius] = hash & aBitMask;
+			radius++;
+		}
+		for (; radius <= aMaxRadius; radius++)
+			codes[radius] = 0;
+	}
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+// same codes as HashFuncNSPDK_scalar, 8 start positions per step in the lanes of an AVX2 register;
+// the parity of the hashed position alternates between neighbouring lanes and with every radius.
+// Start positions whose neighborhoods are cut by the sequence end are left to the scalar version.
+__attribute__((target("avx2")))
+static void HashFuncNSPDK_avx2(const char* aSeq, unsigned aSize, unsigned aFirst, unsigned aLast, unsigned aMaxRadius, unsigned aBitMask, bool aRelativeParity, unsigned* aCodes) {
+	const unsigned numCodes = aMaxRadius + 1;
+	const __m256i mask = _mm256_set1_epi32(aBitMask);
+	const __m256i ones = _mm256_set1_epi32(-1);
+	alignas(32) unsigned lanes[8];
+	unsigned start = aFirst;
+	for (; start + 8 <= aLast && start + 7 + aMaxRadius < aSize; start += 8) {
+		__m256i hash = _mm256_set1_epi32(0xAAAAAAAA);
+		__m256i even = aRelativeParity ? ones : (start & 1) ? _mm256_setr_epi32(0, -1, 0, -1, 0, -1, 0, -1) : _mm256_setr_epi32(-1, 0, -1, 0, -1, 0, -1, 0);
+		for (unsigned r = 0; r <= aMaxRadius; r++) {
+			__m256i c = _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i*) (aSeq + start + r)));
+			__m256i he = _mm256_xor_si256(_mm256_slli_epi32(hash, 7), _mm256_mullo_epi32(c, _mm256_srli_epi32(hash, 3)));
+			__m256i ho = _mm256_xor_si256(_mm256_xor_si256(_mm256_add_epi32(_mm256_slli_epi32(hash, 11), c), _mm256_srli_epi32(hash, 5)), ones);
+			hash = _mm256_xor_si256(hash, _mm256_blendv_epi8(ho, he, even));
+			_mm256_store_si256((__m256i*) lanes, _mm256_and_si256(hash, mask));
+			for (unsigned j = 0; j < 8; j++)
+				aCodes[(start + j) * numCodes + r] = lanes[j];
+			even = _mm256_xor_si256(even, ones);
+		}
+	}
+	HashFuncNSPDK_scalar(aSeq, aSize, start, aLast, aMaxRadius, aBitMask, aRelativeParity, aCodes);
+}
+
+// 16 start positions per step, see HashFuncNSPDK_avx2
+__attribute__((target("avx512f")))
+static void HashFuncNSPDK_avx512(const char* aSeq, unsigned aSize, unsigned aFirst, unsigned aLast, unsigned aMaxRadius, unsigned aBitMask, bool aRelativeParity, unsigned* aCodes) {
+	const unsigned numCodes = aMaxRadius + 1;
+	const __m512i mask = _mm512_set1_epi32(aBitMask);
+	const __m512i ones = _mm512_set1_epi32(-1);
+	// the zero masked forms of convert and shift, the plain ones start from an undefined register
+	const __mmask16 all = 0xFFFF;
+	alignas(64) unsigned lanes[16];
+	unsigned start = aFirst;
+	for (; start + 16 <= aLast && start + 15 + aMaxRadius < aSize; start += 16) {
+		__m512i hash = _mm512_set1_epi32(0xAAAAAAAA);
+		__mmask16 even = aRelativeParity ? 0xFFFF : (start & 1) ? 0xAAAA : 0x5555;
+		for (unsigned r = 0; r <= aMaxRadius; r++) {
+			__m512i c = _mm512_maskz_cvtepi8_epi32(all, _mm_loadu_si128((const __m128i*) (aSeq + start + r)));
+			__m512i he = _mm512_xor_si512(_mm512_maskz_slli_epi32(all, hash, 7), _mm512_mullo_epi32(c, _mm512_maskz_srli_epi32(all, hash, 3)));
+			__m512i ho = _mm512_xor_si512(_mm512_xor_si512(_mm512_add_epi32(_mm512_maskz_slli_epi32(all, hash, 11), c), _mm512_maskz_srli_epi32(all, hash, 5)), ones);
+			hash = _mm512_xor_si512(hash, _mm512_mask_blend_epi32(even, ho, he));
+			_mm512_store_si512((__m512i*) lanes, _mm512_and_si512(hash, mask));
+			for (unsigned j = 0; j < 16; j++)
+				aCodes[(start + j) * numCodes + r] = lanes[j];
+			even = ~even;
+		}
+	}
+	HashFuncNSPDK_avx2(aSeq, aSize, start, aLast, aMaxRadius, aBitMask, aRelativeParity, aCodes);
+}
+#endif
+
+void MinHashEncoder::InitNSPDKKernel() {
+	mNSPDKKernel = HashFuncNSPDK_scalar;
+	string name = "scalar";
+#if defined(__x86_64__) && defined(__GNUC__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) {
+		mNSPDKKernel = HashFuncNSPDK_avx512;
+		name = "avx512";
+	} else if (__builtin_cpu_supports("avx2")) {
+		mNSPDKKernel = HashFuncNSPDK_avx2;
+		name = "avx2";
+	}
+#endif
+	cout << "feature kernel " << name << endl;
+}
+
+inline void MinHashEncoder::HashFuncNSPDK(const string& aString, unsigned aFirst, unsigned aLast, unsigned aMaxRadius, unsigned aBitMask, unsigned* aCodes) {
+	mNSPDKKernel(aString.data(), aString.size(), aFirst, aLast, aMaxRadius, aBitMask, mpParameters->mCanonicalStrand, aCodes);
+}
+
+// pair feature of two neighborhoods, equal to HashFunc([r, d, max, min]) when aSeed is the
+// hash state after r and d (see InitPairKernel)
+static inline unsigned PairHash(unsigned aSeed, unsigned aSrc, unsigned aDest) {
+	unsigned hash = aSeed;
+	hash ^= (hash << 7) ^ max(aSrc, aDest) * (hash >> 3);
+	hash ^= ~(((hash << 11) + min(aSrc, aDest)) ^ (hash >> 5));
+	return hash;
+}
+
+// pair features of the start positions [aFirst,aLast) from the neighborhood codes of HashFuncNSPDK,
+// written row-wise (one row of (radius,distance) features per start position) into oPairs, row 0 is aFirst
+static inline __attribute__((always_inline)) void PairFeatures_body(const unsigned* aCodes, unsigned aSize, unsigned aFirst, unsigned aLast, const unsigned* aSeeds, unsigned aMinRadius, unsigned aRadius, unsigned aMinDistance, unsigned aDistance, unsigned aBitMask, unsigned* oPairs) {
+	const unsigned numCodes = aRadius + 1;
+	const unsigned numPairs = (aRadius - aMinRadius + 1) * (aDistance - aMinDistance + 1);
+	for (unsigned start = aFirst; start < aLast; start++) {
+		const unsigned* src = aCodes + start * numCodes;
+		unsigned* pairs = oPairs + (start - aFirst) * numPairs;
+		unsigned p = 0;
+		if (start + aDistance < aSize) {
+			for (unsigned r = aMinRadius; r <= aRadius; r++)
+				for (unsigned d = aMinDistance; d <= aDistance; d++, p++)
+					pairs[p] = PairHash(aSeeds[p], src[r], src[d * numCodes + r]) & aBitMask;
+		} else {
+			// destinations beyond the sequence end are clipped to the last position
+			for (unsigned r = aMinRadius; r <= aRadius; r++)
+				for (unsigned d = aMinDistance; d <= aDistance; d++, p++)
+					pairs[p] = PairHash(aSeeds[p], src[r], aCodes[min(start + d, aSize - 1) * numCodes + r]) & aBitMask;
+		}
+	}
+}
+
+static void PairFeatures_generic(const unsigned* aCodes, unsigned aSize, unsigned aFirst, unsigned aLast, const unsigned* aSeeds, unsigned aMinRadius, unsigned aRadius, unsigned aMinDistance, unsigned aDistance, unsigned aBitMask, unsigned* oPairs) {
+	if (aRadius < aMinRadius || aDistance < aMinDistance)
+		return;
+	PairFeatures_body(aCodes, aSize, aFirst, aLast, aSeeds, aMinRadius, aRadius, aMinDistance, aDistance, aBitMask, oPairs);
+}
+
+// the same with the radius/distance setting fixed at compile time, the loops over (radius,distance) are unrolled
+template<unsigned MINR, unsigned R, unsigned MIND, unsigned D>
+static void PairFeatures_fixed(const unsigned* aCodes, unsigned aSize, unsigned aFirst, unsigned aLast, const unsigned* aSeeds, unsigned, unsigned, unsigned, unsigned, unsigned aBitMask, unsigned* oPairs) {
+	unsigned seeds[(R - MINR + 1) * (D - MIND + 1)];
+	memcpy(seeds, aSeeds, sizeof(seeds));
+	PairFeatures_body(aCodes, aSize, aFirst, aLast, seeds, MINR, R, MIND, D, aBitMask, oPairs);
+}
+
+// radius/distance settings with a fixed kernel: the defaults and the setting of the README example
+static const struct {
+	unsigned minRadius, radius, minDistance, distance;
+	void (*kernel)(const unsigned*, unsigned, unsigned, unsigned, const unsigned*, unsigned, unsigned, unsigned, unsigned, unsigned, unsigned*);
+} fixedPairKernels[] = {
+	{ 0, 2, 0, 5, PairFeatures_fixed<0, 2, 0, 5> },
+	{ 6, 6, 14, 14, PairFeatures_fixed<6, 6, 14, 14> },
+};
+
+// with a numa mode the pool threads are pinned round robin over the nodes, one cpu each;
+// all stages run on these threads, so readers, workers and output follow the same placement
+void MinHashEncoder::InitNuma() {
+	mThreadNode.clear();
+	if (mpParameters->mNumaCode == NUMA_OFF)
+		return;
+	const unsigned numNodes = mTopology.num_nodes();
+	unsigned pinned = 0;
+	for (unsigned i = 0; i < mTasks.size(); i++) {
+		unsigned node = i % numNodes;
+		const vector<unsigned>& cpus = mTopology.node_cpus(node);
+		if (mTasks.pin(i, cpus[(i / numNodes) % cpus.size()]))
+			pinned++;
+		mThreadNode.push_back(node);
 	}
-	return code_list;
+	cout << "NUMA " << mpParameters->mNuma << ": " << numNodes << " node(s), " << pinned << "/" << mTasks.size() << " threads pinned" << endl;
+}
+
+unsigned MinHashEncoder::ThreadNode() {
+	unsigned t = mTasks.thread_index();
+	return t < mThreadNode.size() ? mThreadNode[t] : 0;
+}
+
+void MinHashEncoder::InitPairKernel() {
+	const unsigned& mRadius = mpParameters->mRadius;
+	const unsigned& mDistance = mpParameters->mDistance;
+	const unsigned& mMinRadius = mpParameters->mMinRadius;
+	const unsigned& mMinDistance = mpParameters->mMinDistance;
+
+	// hash state of HashFunc([r, d, ...]) after its first two elements
+	mPairSeeds.clear();
+	for (unsigned r = mMinRadius; r <= mRadius; r++) {
+		for (unsigned d = mMinDistance; d <= mDistance; d++) {
+			unsigned hash = 0xAAAAAAAA;
+			hash ^= (hash << 7) ^ r * (hash >> 3);
+			hash ^= ~(((hash << 11) + d) ^ (hash >> 5));
+			mPairSeeds.push_back(hash);
+		}
+	}
+
+	mPairKernel = PairFeatures_generic;
+	string name = "generic";
+	for (unsigned i = 0; i < sizeof(fixedPairKernels) / sizeof(fixedPairKernels[0]); i++) {
+		if (fixedPairKernels[i].minRadius == mMinRadius && fixedPairKernels[i].radius == mRadius
+				&& fixedPairKernels[i].minDistance == mMinDistance && fixedPairKernels[i].distance == mDistance) {
+			mPairKernel = fixedPairKernels[i].kernel;
+			name = "fixed";
+		}
+	}
+	cout << "pair kernel " << name << endl;
 }
 
 //void MinHashEncoder::generate_feature_vector(const GraphClass& aG, SVector& x) {
 //void MinHashEncoder::generate_feature_vector(const string& seq, SVector& x) {
-inline void  MinHashEncoder::generate_feature_vector(const string& seq, SVector& x) {
+// codes and pair rows go to the buffers of aCache.next, which the worker reuses for all instances
+inline void  MinHashEncoder::generate_feature_vector(const string& seq, FeatureSetT& x, FeatureCacheT& aCache, Signature* aSignature) {
 //	x.set_empty_key(0);
 //	x.resize(5000);
-	x.resize(pow(2, mpParameters->mHashBitSize));
+	x.Clear();
 	//assume there is a mMinRadius and a mMinDistance
 	unsigned& mRadius = mpParameters->mRadius;
 	unsigned& mDistance = mpParameters->mDistance;
@@ -56,342 +257,811 @@ inline void  MinHashEncoder::generate_feature_vector(const string& seq, SVector&
 	//assume 1 vertex with all info on the label
 	//string seq = aG.GetVertexLabel(0);
 	unsigned size = seq.size();
+	const unsigned numCodes = mRadius + 1;
+
+	//create neighborhood features
+	vector<unsigned>& codes = aCache.next.codes;
+	codes.resize(size * numCodes);
+	HashFuncNSPDK(seq, 0, size, mRadius, mHashBitMask, codes.data());
+
+	const unsigned numPairs = mPairSeeds.size();
+	if (aSignature) {
+		// one row of pair features per start position goes straight into the signature
+		vector<unsigned>& pairs = aCache.next.pairs;
+		pairs.resize(numPairs);
+		for (unsigned start = 0; start < size; start++) {
+			mPairKernel(codes.data(), size, start, start + 1, mPairSeeds.data(), mMinRadius, mRadius, mMinDistance, mDistance, mHashBitMask, pairs.data());
+			for (unsigned p = 0; p < numPairs; p++)
+				UpdateHashSignature(pairs[p], *aSignature);
+		}
+	} else {
+		x.ids.resize(size * numPairs);
+		mPairKernel(codes.data(), size, 0, size, mPairSeeds.data(), mMinRadius, mRadius, mMinDistance, mDistance, mHashBitMask, x.ids.data());
+	}
+	//x /= x.norm();
+	x.Finalize();
+}
+
+// previous window of the same strand that overlaps aCur, position start in aCur is position start+oOffset there.
+// codes depend on the parity of the position inside the window (see HashFuncNSPDK), so the offset has
+// to be even (except for canonical_strand); with an odd shift we reuse the window before the last one
+const MinHashEncoder::FeatureWindowT* MinHashEncoder::FindPreviousWindow(const FeatureWindowT (&aHistory)[2], const FeatureWindowT& aCur, bool aRC, int& oOffset) {
+	const int size = aCur.seq.size();
+	for (unsigned age = 0; age < 2; age++) {
+		const FeatureWindowT& w = aHistory[age];
+		const int wSize = w.seq.size();
+		if (wSize == 0)
+			continue;
+		// reverse complement windows run backwards along the sequence
+		int o = aRC ? ((int) w.pos + wSize) - ((int) aCur.pos + size) : (int) aCur.pos - (int) w.pos;
+		int first = max(0, -o);
+		int last = min(size, wSize - o);
+		if ((o % 2 != 0 && !mpParameters->mCanonicalStrand) || first >= last)
+			continue;
+		// positions alone do not identify the sequence, so only reuse if the overlap is really the same
+		if (aCur.seq.compare(first, last - first, w.seq, first + o, last - first) == 0) {
+			oOffset = o;
+			return &w;
+		}
+	}
+	oOffset = 0;
+	return NULL;
+}
+
+// neighborhood codes of aCur.seq; only neighborhoods that are complete in both windows are the same,
+// these are the positions [reuseBegin,reuseEnd) that are copied from aPrev, the rest is hashed in two batches
+void MinHashEncoder::ComputeWindowCodes(FeatureWindowT& aCur, const FeatureWindowT* aPrev, int aOffset) {
+	const unsigned& mRadius = mpParameters->mRadius;
+	const int size = aCur.seq.size();
+	const unsigned numCodes = mRadius + 1;
+
+	aCur.codes.resize(size * numCodes);
+	int reuseBegin = size, reuseEnd = size;
+	if (aPrev) {
+		reuseBegin = max(0, -aOffset);
+		reuseEnd = min((int) aPrev->seq.size() - aOffset, size) - (int) mRadius;
+		if (reuseEnd <= reuseBegin)
+			reuseBegin = reuseEnd = size;
+	}
+	HashFuncNSPDK(aCur.seq, 0, reuseBegin, mRadius, mHashBitMask, aCur.codes.data());
+	if (reuseEnd > reuseBegin)
+		memcpy(&aCur.codes[reuseBegin * numCodes], &aPrev->codes[(reuseBegin + aOffset) * numCodes], (reuseEnd - reuseBegin) * numCodes * sizeof(unsigned));
+	HashFuncNSPDK(aCur.seq, reuseEnd, size, mRadius, mHashBitMask, aCur.codes.data());
+}
 
-	vector<vector<unsigned> > mFeatureCache;
-	for (unsigned i = 0; i < size; ++i) {
-		mFeatureCache.push_back(vector<unsigned>(mRadius, 0));
+// same features as generate_feature_vector(seq,x), but neighborhood codes and pair features
+// of positions shared with the previous window(s) of the same sequence/strand are taken from
+// aCache instead of being hashed again; only the edges of the window are computed.
+// With canonical_strand the code of a neighborhood is the min of the codes of both strands and
+// only pairs of complete neighborhoods are used, so a window and its reverse complement have
+// the same features.
+void MinHashEncoder::generate_feature_vector(const InstanceT& aInstance, FeatureSetT& x, FeatureCacheT& aCache, Signature* aSignature) {
+
+	const bool canonical = mpParameters->mCanonicalStrand;
+
+	// the window is decoded from the packed parent sequence straight into the cache buffer
+	FeatureWindowT& cur = aCache.next;
+	GetInstanceSeq(aInstance, cur.seq);
+	const string& seq = cur.seq;
+
+	// whole sequences (no window/shift) never overlap
+	if (!canonical && (mpParameters->mSeqWindow == 0 || seq.size() == 0)) {
+		generate_feature_vector(seq, x, aCache, aSignature);
+		return;
 	}
 
+	const unsigned& mRadius = mpParameters->mRadius;
+	const unsigned& mDistance = mpParameters->mDistance;
+	const unsigned& mMinRadius = mpParameters->mMinRadius;
+	const unsigned& mMinDistance = mpParameters->mMinDistance;
+
+	const int size = seq.size();
+	const unsigned numCodes = mRadius + 1;
+	const unsigned numPairs = mPairSeeds.size();
+	const int maxReach = mRadius + mDistance;
+
 	//create neighborhood features
-	for (unsigned start = 0; start < size; ++start)
-		mFeatureCache[start] = HashFuncNSPDK(seq, start, mRadius, mHashBitMask);
+	FeatureWindowT (&history)[2] = aCache.win[aInstance.rc ? 1 : 0];
+	int offset = 0;
+	cur.pos = aInstance.pos;
+	const FeatureWindowT* prev = FindPreviousWindow(history, cur, aInstance.rc, offset);
+	ComputeWindowCodes(cur, prev, offset);
+	const vector<unsigned>* codes = &cur.codes;
+
+	if (canonical) {
+		// codes of the reverse complement window, with their own history; row j there
+		// is the neighborhood that ends at position size-1-j here
+		FeatureWindowT& curRC = aCache.nextRC;
+		if (aInstance.rc)
+			aInstance.seq->Unpack(aInstance.pos, aInstance.len, curRC.seq);
+		else
+			aInstance.seq->UnpackRevCompl(aInstance.pos, aInstance.len, curRC.seq);
+		int offsetRC = 0;
+		curRC.pos = aInstance.pos;
+		const FeatureWindowT* prevRC = FindPreviousWindow(aCache.win[aInstance.rc ? 0 : 1], curRC, !aInstance.rc, offsetRC);
+		ComputeWindowCodes(curRC, prevRC, offsetRC);
+
+		cur.canon.resize(size * numCodes);
+		for (int start = 0; start < size; ++start) {
+			for (unsigned r = 0; r <= mRadius; r++) {
+				int end = start + r;
+				cur.canon[start * numCodes + r] = (end < size) ? min(cur.codes[start * numCodes + r], curRC.codes[(size - 1 - end) * numCodes + r]) : 0;
+			}
+		}
+		codes = &cur.canon;
+		// the pairs of prev are only the same if both of its strands match this window
+		if (prev && !(prevRC && prevRC->pos == prev->pos && prevRC->seq.size() == prev->seq.size()))
+			prev = NULL;
+
+		FeatureWindowT (&historyRC)[2] = aCache.win[aInstance.rc ? 0 : 1];
+		std::swap(historyRC[1], curRC);
+		std::swap(historyRC[0], historyRC[1]);
+	}
 
-	vector<unsigned> endpoint_list(4);
-	for (unsigned r = mMinRadius; r <= mRadius; r++) {
-		endpoint_list[0] = r;
-		for (unsigned d = mMinDistance; d <= mDistance; d++) {
-			endpoint_list[1] = d;
-		//	SVector z(pow(2, mpParameters->mHashBitSize));
-			for (unsigned start = 0; start < size; ++start) {
-				unsigned src_code = mFeatureCache[start][r];
-				unsigned effective_dest = min(start + d, size - 1);
-				unsigned dest_code = mFeatureCache[effective_dest][r];
-				if (src_code > dest_code) {
-					endpoint_list[2] = src_code;
-					endpoint_list[3] = dest_code;
-				} else {
-					endpoint_list[3] = src_code;
-					endpoint_list[2] = dest_code;
+	cur.pairs.resize(size * numPairs);
+	if (!aSignature)
+		x.Clear();
+
+	// pairs whose destination is neither clipped nor truncated at the window end are the same as in
+	// prev, these are the positions [reuseBegin,reuseEnd); the rest is computed in two batches
+	int reuseBegin = size, reuseEnd = size;
+	if (prev) {
+		reuseBegin = max(0, -offset);
+		reuseEnd = min(size, (int) prev->seq.size() - offset) - maxReach;
+		if (reuseEnd <= reuseBegin)
+			reuseBegin = reuseEnd = size;
+	}
+	mPairKernel(codes->data(), size, 0, reuseBegin, mPairSeeds.data(), mMinRadius, mRadius, mMinDistance, mDistance, mHashBitMask, cur.pairs.data());
+	if (reuseEnd > reuseBegin)
+		memcpy(&cur.pairs[reuseBegin * numPairs], &prev->pairs[(reuseBegin + offset) * numPairs], (reuseEnd - reuseBegin) * numPairs * sizeof(unsigned));
+	mPairKernel(codes->data(), size, reuseEnd, size, mPairSeeds.data(), mMinRadius, mRadius, mMinDistance, mDistance, mHashBitMask, cur.pairs.data() + reuseEnd * numPairs);
+
+	for (int start = 0; start < size; ++start) {
+		unsigned* pairs = &cur.pairs[start * numPairs];
+		if (canonical && start + maxReach >= size) {
+			// near the window end only pairs of complete neighborhoods have a counterpart on the other strand
+			unsigned p = 0;
+			for (unsigned r = mMinRadius; r <= mRadius; r++) {
+				for (unsigned d = mMinDistance; d <= mDistance; d++, p++) {
+					if (start + d + r >= (unsigned) size)
+						continue;
+					if (aSignature)
+						UpdateHashSignature(pairs[p], *aSignature);
+					else
+						x.Add(pairs[p]);
 				}
-				unsigned code = HashFunc(endpoint_list, mHashBitMask);
-				//				z.coeffRef(code) += 1;
-				//
-				//				//add feature that ignore src endpoint
-				//				//NOTE: this is important when the label of src vertex is considered noisy, in this way, it is only the context that will define the features
-				//				endpoint_list[2] = 0;
-				//				endpoint_list[3] = dest_code;
-				//				unsigned nosrc_code = HashFunc(endpoint_list, mHashBitMask);
-				//				z.coeffRef(nosrc_code) += 1;
-				x.coeffRef(code) = 1;
-				//x.insert(code);
 			}
-			//z /= z.norm();
-			//x += z;
+		} else if (aSignature) {
+			for (unsigned p = 0; p < numPairs; p++)
+				UpdateHashSignature(pairs[p], *aSignature);
+		} else {
+			x.ids.insert(x.ids.end(), pairs, pairs + numPairs);
 		}
 	}
-	//x /= x.norm();
-}
+	if (!aSignature)
+		x.Finalize();
 
-void MinHashEncoder::worker_readFiles(int numWorkers){
+	// current window becomes the last one, the oldest window's buffers are recycled
+	std::swap(history[1], cur);
+	std::swap(history[0], history[1]);
+}
 
-	while (!done){
+void MinHashEncoder::featureSetS::Finalize() {
+	const unsigned n = ids.size();
+	if (n < 256) {
+		std::sort(ids.begin(), ids.end());
+	} else {
+		// LSD radix sort on bytes, passes where all ids share the byte are skipped
+		tmp.resize(n);
+		unsigned count[256];
+		for (unsigned shift = 0; shift < 32; shift += 8) {
+			memset(count, 0, sizeof(count));
+			for (unsigned i = 0; i < n; i++)
+				count[(ids[i] >> shift) & 0xFF]++;
+			if (count[(ids[0] >> shift) & 0xFF] == n)
+				continue;
+			unsigned sum = 0;
+			for (unsigned b = 0; b < 256; b++) {
+				unsigned c = count[b];
+				count[b] = sum;
+				sum += c;
+			}
+			for (unsigned i = 0; i < n; i++)
+				tmp[count[(ids[i] >> shift) & 0xFF]++] = ids[i];
+			ids.swap(tmp);
+		}
+	}
+	ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+}
 
-		SeqFileP myData;
-		bool succ = readFile_queue.try_pop(myData);
+// next instance of aSeq, the slot is reused with its signature buffer from an earlier use of the chunk
+// the second mate of a read pair (aMate) shares the name of the first one
+MinHashEncoder::InstanceT& MinHashEncoder::chunkS::Add(const PackedSeqP& aSeq, const string& aName, bool aMate) {
+	if (seqs.empty() || seqs.back() != aSeq) {
+		seqs.push_back(aSeq);
+		if (!aMate || nameEnd.empty()) {
+			names.append(aName);
+			nameEnd.push_back(names.size());
+		}
+	}
+	if (num == inst.size())
+		inst.resize(num + 1);
+	InstanceT& myInstance = inst[num++];
+	myInstance.seqIdx = nameEnd.size() - 1;
+	myInstance.seq = seqs.back().get();
+	return myInstance;
+}
 
-		if (!done && succ && myData->filename != ""){
+string MinHashEncoder::chunkS::Name(unsigned i) const {
+	unsigned s = inst[i].seqIdx;
+	unsigned b = s ? nameEnd[s - 1] : 0;
+	return names.substr(b, nameEnd[s] - b);
+}
 
-			cout << endl << "read next file " << myData->filename << " sig_all_counter " << mSignatureCounter << " inst_counter "<< mInstanceCounter  << endl;
-			igzstream fin;
-			fin.open(myData->filename.c_str(),std::ios::in);
+void MinHashEncoder::chunkS::clear() {
+	num = 0;
+	seqs.clear();
+	names.clear();
+	nameEnd.clear();
+	seqFile.reset();
+}
 
-			if (!fin)
-				throw range_error("ERROR Data::LoadData: Cannot open file: " + myData->filename);
+void MinHashEncoder::GetInstanceSeq(const InstanceT& aInstance, string& oSeq) {
+	if (aInstance.rc)
+		aInstance.seq->UnpackRevCompl(aInstance.pos, aInstance.len, oSeq);
+	else
+		aInstance.seq->Unpack(aInstance.pos, aInstance.len, oSeq);
+}
 
-			std::tr1::unordered_map<string, uint8_t> seq_names_seen;
+// one step of a reader: takes the next chunk of its read task (or the next read task) and
+// goes on in a new task, which idle threads can steal, while this one processes the chunk;
+// the reader is parked instead while the later stages are behind
+void MinHashEncoder::task_readFiles(ReaderP aReader){
 
-			unsigned pos = 0; // tracks the current seq start pos (window/shift)
-			unsigned end = 0; // tracks the current seq end pos, set from BED entry or to full seq end
-			unsigned idx = 0; // holds the instance id for the inverse index
+	ReaderT& r = *aReader;
+	if (r.parked != pipeline_stats::clockT::time_point()) {
+		mStats->wait_out(READ_STAGE, pipeline_stats::ns(r.parked, pipeline_stats::clockT::now()));
+		r.parked = pipeline_stats::clockT::time_point();
+	}
+	while (!r.chunk) {
 
-			bool valid_input = false; // set to false so that we get new seq in while further down directly
-			string currSeq;
-			string currFullSeq;
-			string currSeqName;
+		if (!r.open) {
+			if (!readFile_queue.try_pop(r.task)){
+				readers_active--;
+				return;
+			}
+			r.taskChunks = 0;
+			SeqFileP myData = r.task.seqFile;
+			if (myData->filename == ""){
+				endReadTask(r.task.order, 0);
+				continue;
+			}
 
-			std::pair<Data::BEDdataIt,Data::BEDdataIt> annoEntries;
-			Data::BEDdataIt it; // iteratore over all bed entries of current seq
+			// uncompressed FASTA files (and their parts) are memory mapped, other whole files (also stdin "-") go
+			// through igzstream, parts of a split file that cannot be mapped are read from their byte range
+			bool open_ok;
+			r.fin_gz.clear();
+			r.fin_part.clear();
+			if (r.task.end > 0)
+				cout << endl << "read next file " << myData->filename << " part " << r.task.part << " (" << r.task.begin << "-" << r.task.end << ")" << endl;
+			else
+				cout << endl << "read next file " << myData->filename << " sig_all_counter " << mSignatureCounter << " inst_counter "<< mInstanceCounter  << endl;
+			r.mapped = myData->filetype == FASTA && r.fin_map.Open(myData->filename, r.task.begin, r.task.end);
+			if (r.mapped) {
+				open_ok = true;
+			} else if (r.task.end > 0) {
+				open_ok = r.fin_range.open(myData->filename, r.task.begin, r.task.end);
+				r.fin = &r.fin_part;
+			} else {
+				r.fin_gz.open(myData->filename.c_str(),std::ios::in,myData->filename_mate == "" ? mInflateThreads : std::max(1u, mInflateThreads / 2));
+				open_ok = r.fin_gz.good();
+				r.fin = &r.fin_gz;
+			}
 
-			while (!fin.eof()) {
+			if (!open_ok)
+				throw range_error("ERROR Data::LoadData: Cannot open file: " + myData->filename);
+			if (mpParameters->mCanonicalStrand && myData->strandType == FR_sep)
+				throw range_error("ERROR Data::LoadData: separate results per strand (FR_sep) need strand specific features, canonical_strand cannot be used");
+
+			r.pos = 0;
+			r.end = 0;
+			r.idx = 0;
+			r.valid_input = false; // set to false so that we get new seq in while further down directly
+			r.currSeqStart = 0;
+			r.currSeqSize = 0;
+			r.currFullSeq.reset();
+			r.currSeqName = "";
+			r.lowQual.clear();
+			r.mateSeq.reset();
+			r.mateLowQual.clear();
+			r.onMate = false;
+			r.readWindows = 0;
+			if (myData->filename_mate != "") {
+				r.fin_mate.clear();
+				r.fin_mate.open(myData->filename_mate.c_str(),std::ios::in,std::max(1u, mInflateThreads / 2));
+				if (!r.fin_mate.good())
+					throw range_error("ERROR Data::LoadData: Cannot open mate file: " + myData->filename_mate);
+			}
+			r.anno = 0;
+			r.annoEnd = 0;
+			r.open = true;
+		}
 
-				unsigned maxB = max(1000,(int)log2((double)mSignatureCounter)*200);
-				unsigned currBuff = rand()%(maxB*3 - maxB + 1) + maxB; // curr chunk size
-				unsigned i = 0;			// current fragment in currBuff
-				bool lastSeqGr = false; // indicates that we have the last fragment from current seq, used to get all fragments from current seq into current chunk
-				// necessary to have all fragments for one seq/feature if we want to combine signatures in finisher
+		if (!ReadChunk(r)){
+			r.fin_gz.close();
+			r.fin_range.close();
+			r.fin_map.Close();
+			SeqFileP myData = r.task.seqFile;
+			if (myData->filename_mate != "") {
+				if ((r.fin_mate >> std::ws).peek() != EOF)
+					throw range_error("ERROR paired input: mate file " + myData->filename_mate + " has more records than " + myData->filename);
+				r.fin_mate.close();
+			}
+			r.open = false;
+			if (r.task.part == 0)
+				files_done++;
+			endReadTask(r.task.order, r.taskChunks);
+		}
+	}
 
-				ChunkP 		myChunkP = std::make_shared<ChunkT>();
+	{
+		std::lock_guard<std::mutex> lk(mut_readers);
+		if (chunks_in_flight >= max_in_flight || !beginChunk(r.chunk->task)){
+			r.parked = pipeline_stats::clockT::now();
+			parked_readers.push_back(aReader);
+			return;
+		}
+		chunks_in_flight++;
+	}
+	ChunkP myChunkP = r.chunk;
+	r.chunk.reset();
+	mTasks.submit(std::bind(&MinHashEncoder::task_readFiles, this, aReader));
+	mChunkTask(std::move(myChunkP));
+}
 
-				while ( ((i<currBuff) && !fin.eof()) || (myData->signatureAction==CLASSIFY && i>=currBuff && lastSeqGr == false) ) {
+// read name without a /1 resp. /2 mate suffix
+static string PairName(const string& aName) {
+	if (aName.size() > 2 && aName[aName.size() - 2] == '/' && (aName.back() == '1' || aName.back() == '2'))
+		return aName.substr(0, aName.size() - 2);
+	return aName;
+}
 
-					//cout << "valid? " << valid_input << " name :" << currSeqName << ": pos " << pos << " end " << end <<  endl;
-					if (!valid_input) {
-						if  ( it == annoEntries.second ) {
-							// last seq and all bed entries for it are finished, get next seq from file
+// the record of the mate file that belongs to the first mate ioName, which becomes the name of the pair
+void MinHashEncoder::ReadMate(ReaderT& aReader, string& ioName){
+	SeqFileP myData = aReader.task.seqFile;
+	string mateName;
+	aReader.mateSeq = std::make_shared<PackedSeq>();
+	if (myData->filetype == FASTQ)
+		mpData->GetNextFastqSeq(aReader.fin_mate, *aReader.mateSeq, mateName, aReader.mateLowQual);
+	else
+		mpData->GetNextFastaSeq(aReader.fin_mate, *aReader.mateSeq, mateName);
+	if (aReader.fin_mate.eof())
+		throw range_error("ERROR paired input: mate file " + myData->filename_mate + " has fewer records than " + myData->filename);
+	string name = PairName(ioName);
+	if (name != PairName(mateName))
+		throw range_error("ERROR paired input: mates " + ioName + " and " + mateName + " do not match");
+	ioName = name;
+}
 
-							switch (myData->filetype) {
-							case FASTA:
-								mpData->GetNextFastaSeq(fin, currFullSeq, currSeqName);
-								if (fin.eof() )
-									continue;
-								mSequenceCounter++;
-								if (myData->checkUniqueSeqNames && seq_names_seen.count(currSeqName) > 0) {
+// next chunk of the reader's read task into aReader.chunk, false at the end of the task
+bool MinHashEncoder::ReadChunk(ReaderT& aReader){
+
+	SeqFileP myData = aReader.task.seqFile;
+	istream& fin = *aReader.fin;
+	MappedFasta& fin_map = aReader.fin_map;
+	auto at_end = [&aReader,&fin](){ return aReader.mapped ? aReader.fin_map.Eof() : fin.eof(); };
+	SeqNamesT& seq_names_seen = *aReader.task.seqNames;
+	unsigned& pos = aReader.pos;
+	unsigned& end = aReader.end;
+	unsigned& idx = aReader.idx;
+	bool& valid_input = aReader.valid_input;
+	unsigned& currSeqStart = aReader.currSeqStart;
+	unsigned& currSeqSize = aReader.currSeqSize;
+	PackedSeqP& currFullSeq = aReader.currFullSeq;
+	string& currSeqName = aReader.currSeqName;
+	unsigned& anno = aReader.anno;
+	unsigned& annoEnd = aReader.annoEnd;
+
+	while (!at_end()) {
+
+
+		uint64_t currBuff = mChunker.next_size(); // curr chunk size in bases
+		uint64_t chunkBases = 0;
+		unsigned i = 0;			// current fragment in currBuff
+		bool lastSeqGr = false; // indicates that we have the last fragment from current seq, used to get all fragments from current seq into current chunk
+		// necessary to have all fragments for one seq/feature if we want to combine signatures in finisher
+
+		ChunkP 		myChunkP = mChunkPool.get();
+		myChunkP->seqFile = myData;
+		myChunkP->created = pipeline_stats::clockT::now();
+
+		// with paired-end input both mates have to go to the same chunk
+		while ( ((chunkBases<currBuff) && !at_end()) || (myData->signatureAction==CLASSIFY && chunkBases>=currBuff && (lastSeqGr == false || aReader.mateSeq)) ) {
+
+			if (!valid_input) {
+				if  ( anno == annoEnd ) {
+					// last seq and all bed entries for it are finished, get next seq from file
+
+					if (aReader.mateSeq) {
+						// second mate of a pair, its windows go to the same fragment as those of the first one
+						currFullSeq = aReader.mateSeq;
+						aReader.mateSeq.reset();
+						aReader.lowQual.swap(aReader.mateLowQual);
+						aReader.onMate = true;
+					} else {
+						aReader.onMate = false;
+						aReader.readWindows = 0;
+						switch (myData->filetype) {
+						case FASTA:
+							// new object for every seq, windows still in flight keep the previous one
+							currFullSeq = std::make_shared<PackedSeq>();
+							if (aReader.mapped)
+								fin_map.Next(*currFullSeq, currSeqName);
+							else
+								mpData->GetNextFastaSeq(fin, *currFullSeq, currSeqName);
+							if (at_end())
+								continue;
+							if (myData->filename_mate != "")
+								ReadMate(aReader, currSeqName);
+							mSequenceCounter++;
+							if (myData->checkUniqueSeqNames) {
+								std::lock_guard<std::mutex> lk(mut_names);
+								if (!seq_names_seen.insert(make_pair(currSeqName,1)).second)
 									throw range_error("Sequence names are not unique in FASTA file! "+currSeqName);
-								} else if (myData->checkUniqueSeqNames) {
-									seq_names_seen.insert(make_pair(currSeqName,1));
-								}
-								break;
-							case STRINGSEQ:
-								mpData->GetNextStringSeq(fin, currFullSeq);
-								if (fin.eof() )
-									continue;
-								mSequenceCounter++;
-								currSeqName =  std::to_string(mSequenceCounter);
-								break;
-							default:
-								throw range_error("ERROR Data::LoadData: file type not recognized: " + myData->filetype);
 							}
-
-							// log output
-							if (myData->signatureAction==INDEX){
-						//		cout << endl << " next found Seq #" <<  seq_names_seen.size() << " length " << currFullSeq.size() << ":" << currSeqName << ": " << endl;
-							}
-
-							// if we have bed entries for a seq, find them and set iterator to first bed entry
-							if (myData->dataBED && myData->dataBED->find(currSeqName) != myData->dataBED->end()){
-								annoEntries = myData->dataBED->equal_range(currSeqName);
-								it = annoEntries.first;
-							} else if (myData->dataBED){
-							//	cout << "no bed entry found! "<< seq_names_seen.size()<< endl;
-								// bed is present, but no entry for current seq found -> we take next seq
-								valid_input = false;
+							break;
+						case FASTQ:
+							currFullSeq = std::make_shared<PackedSeq>();
+							mpData->GetNextFastqSeq(fin, *currFullSeq, currSeqName, aReader.lowQual);
+							if (fin.eof() )
 								continue;
-							}
-						} // if no bed entries left for current seq get new seq
-
-						// check if we use the same idx-group for the whole seq, either by seq name or feature id from BED
-						// idx also defines the value under which we insert features into the index
-						switch (myData->groupGraphsBy){
-						// use seq name as value for inverse index
-						case SEQ_NAME:
-							if (mFeature2IndexValue.find(currSeqName) != mFeature2IndexValue.end()){
-								idx = mFeature2IndexValue[currSeqName];
-							} else {
-								myData->lastMetaIdx++;
-								idx=myData->lastMetaIdx;
-								mFeature2IndexValue.insert(make_pair(currSeqName,idx));
+							if (myData->filename_mate != "")
+								ReadMate(aReader, currSeqName);
+							mSequenceCounter++;
+							if (myData->checkUniqueSeqNames) {
+								std::lock_guard<std::mutex> lk(mut_names);
+								if (!seq_names_seen.insert(make_pair(currSeqName,1)).second)
+									throw range_error("Sequence names are not unique in FASTQ file! "+currSeqName);
 							}
 							break;
-							// use given value/name in BED file col4 as  value for inverse index
-						case SEQ_FEATURE:
-							if (mFeature2IndexValue.find(it->second->NAME) != mFeature2IndexValue.end()){
-								idx = mFeature2IndexValue[it->second->NAME];
-							} else {
-								myData->lastMetaIdx++;
-								idx=myData->lastMetaIdx;
-								mFeature2IndexValue.insert(make_pair(it->second->NAME,idx));
-							}
+						case STRINGSEQ:
+							currFullSeq = std::make_shared<PackedSeq>();
+							mpData->GetNextStringSeq(fin, *currFullSeq);
+							if (fin.eof() )
+								continue;
+							mSequenceCounter++;
+							currSeqName =  std::to_string(mSequenceCounter);
 							break;
 						default:
-							break;
+							throw range_error("ERROR Data::LoadData: file type not recognized: " + myData->filetype);
 						}
+					}
 
-						// only true if we have a found a BED entry for current seq
-						// set region according to BED entry
-						if ( it != annoEntries.second ) {
-							pos = it->second->START;
-							end = it->second->END;
-							//mIndexValue2Feature.insert(make_pair(idx,it->second));
-							//cout << endl << "BED entry found for seq name " << currSeqName << " " << it->second->NAME << " MetaIdx "<< idx << " " << pos << "-"<< end << endl;
-							it++;
+					// if we have bed entries for a seq, find their range
+					if (myData->dataBED && !myData->dataBED->Find(currSeqName, anno, annoEnd)){
+						// bed is present, but no entry for current seq found -> we take next seq
+						valid_input = false;
+						continue;
+					}
+				} // if no bed entries left for current seq get new seq
+
+				// check if we use the same idx-group for the whole seq, either by seq name or feature id from BED
+				// idx also defines the value under which we insert features into the index, classification does not use it
+				if (myData->signatureAction != CLASSIFY) {
+					std::lock_guard<std::mutex> lk(mut_names);
+					switch (myData->groupGraphsBy){
+					// use seq name as value for inverse index
+					case SEQ_NAME:
+						if (mFeature2IndexValue.find(currSeqName) != mFeature2IndexValue.end()){
+							idx = mFeature2IndexValue[currSeqName];
 						} else {
-							// no bed is present, then we set start/end to full seq, eg. in case for clustering
-							pos=0;
-							end=currFullSeq.size();
-							//cout << "no BED data present! "<< currSeqName << " " << pos << "-" << end << endl;
+							myData->lastMetaIdx++;
+							idx=myData->lastMetaIdx;
+							mFeature2IndexValue.insert(make_pair(currSeqName,idx));
 						}
-
-						// check if start/end is within bounds of found seq
-						if (pos>currSeq.size() || end > currFullSeq.size())
-							throw range_error(" BED entry start/end is outside current seq ");
-
-						// apply current seq start/end
-						currSeq = currFullSeq.substr(pos,end-pos);
-
-					} // valid_input?
-
-					// new instance for this chunk
-					InstanceT	myInstance;
-					mpData->GetNextWinFromSeq(currSeq, pos, lastSeqGr,myInstance.seq);
-
-					if (myInstance.seq.size() == 0 && !lastSeqGr) {
-						valid_input = false;
-					} else {
-						// fill current Instance with all data
-						// make graph from seq
-
-						valid_input = true;
-
-						switch (myData->groupGraphsBy){
-						case NONE:
-						case SEQ_WINDOW:
-							idx = mInstanceCounter;
-							break;
-						default:
-							break;
+						break;
+						// use given value/name in BED file col4 as  value for inverse index
+					case SEQ_FEATURE:
+						if (mFeature2IndexValue.find(myData->dataBED->Name(anno)) != mFeature2IndexValue.end()){
+							idx = mFeature2IndexValue[myData->dataBED->Name(anno)];
+						} else {
+							myData->lastMetaIdx++;
+							idx=myData->lastMetaIdx;
+							mFeature2IndexValue.insert(make_pair(myData->dataBED->Name(anno),idx));
 						}
+						break;
+					default:
+						break;
+					}
+				}
 
-						if (myData->strandType != REV){
-							//mpData->SetGraphFromSeq(myInstance.seq,myInstance.gr);
+				// only true if we have a found a BED entry for current seq
+				// set region according to BED entry
+				if ( anno != annoEnd ) {
+					pos = myData->dataBED->Start(anno);
+					end = myData->dataBED->End(anno);
+					anno++;
+				} else {
+					// no bed is present, then we set start/end to full seq, eg. in case for clustering
+					pos=0;
+					end=currFullSeq->Size();
+				}
 
-							myInstance.seqFile = myData;
-							myInstance.name = currSeqName;
-							myInstance.idx = idx;
-							myInstance.pos = pos;
-							myInstance.rc = false;
+				// check if start/end is within bounds of found seq
+				if (pos>end || end > currFullSeq->Size())
+					throw range_error(" BED entry start/end is outside current seq ");
+
+				// apply current seq start/end
+				currSeqStart = pos;
+				currSeqSize = end-pos;
+
+			} // valid_input?
+
+			unsigned		winPos = 0; // start of the window within the current region
+			unsigned		winSize = 0;
+			mpData->GetNextWinFromSeq(currSeqSize, pos, lastSeqGr, winPos, winSize);
+
+			if (winSize == 0 && !lastSeqGr) {
+				valid_input = false;
+				// a read (pair) that is trimmed or masked completely has no window, so it gets no result row
+				if (anno == annoEnd && !aReader.mateSeq && aReader.readWindows == 0)
+					mDroppedReads++;
+			} else if (aReader.lowQual.size() && mpData->InRegion(aReader.lowQual, currSeqStart + winPos, winSize)) {
+				// only low quality bases, no instance but the next window of the seq
+				valid_input = true;
+			} else {
+				// fill current Instance with all data
+				// make graph from seq
+
+				valid_input = true;
+
+				switch (myData->groupGraphsBy){
+				case NONE:
+				case SEQ_WINDOW:
+					idx = mInstanceCounter;
+					break;
+				default:
+					break;
+				}
+				// the second mate joins the name of the first one only if that one has windows in the chunk
+				bool pairName = aReader.onMate && aReader.readWindows > 0;
+				aReader.readWindows++;
+
+				if (myData->strandType != REV){
+					//mpData->SetGraphFromSeq(myInstance.seq,myInstance.gr);
+
+					InstanceT& myInstance = myChunkP->Add(currFullSeq, currSeqName, pairName);
+					myInstance.idx = idx;
+					myInstance.pos = currSeqStart + winPos;
+					myInstance.len = winSize;
+					myInstance.rc = false;
+
+					i++;
+					chunkBases += winSize;
+					mInstanceCounter++;
+				}
 
-							myChunkP->push_back(myInstance);
-							i++;
-							mInstanceCounter++;
-						}
+				// with strand canonical features the forward window already stands for both strands
+				if (myData->strandType != FWD && !(mpParameters->mCanonicalStrand && myData->strandType == FR)){
+					InstanceT& myInstanceRC = myChunkP->Add(currFullSeq, currSeqName, pairName);
+					myInstanceRC.idx = idx;
+					myInstanceRC.pos = currSeqStart + winPos;
+					myInstanceRC.len = winSize;
+					myInstanceRC.rc = true;
+					//mpData->SetGraphFromSeq(myInstanceRC.seq,myInstanceRC.gr);
+
+					mInstanceCounter++;
+					i++;
+					chunkBases += winSize;
+				}
 
-						if (myData->strandType != FWD){
-							InstanceT	myInstanceRC;
-							myInstanceRC.seqFile = myData;
-							myInstanceRC.name = currSeqName;
-							myInstanceRC.idx = idx;
-							myInstanceRC.pos = pos;
-							myInstanceRC.rc = true;
-							mpData->GetRevComplSeq(myInstance.seq,myInstanceRC.seq);
-							//mpData->SetGraphFromSeq(myInstanceRC.seq,myInstanceRC.gr);
-
-							myChunkP->push_back(myInstanceRC);
-							mInstanceCounter++;
-							i++;
-						}
+			}
+		} // while buffer not full or eof
 
-					}
-					//cout << "Gr: " << myChunkP->size() << " "<< i << " " << currBuff<< " "<< pos << " " << currSeqName<<  " " << currSeq.size() << " " << lastSeqGr << endl;
-				} // while buffer not full or eof
+		if (i==0) {
+			mChunkPool.put(myChunkP);
+			continue;
+		}
 
-				//cout << "Gr: " << myChunkP->size() << " "<< i << " " << currBuff<< " "<< pos << " " << currSeqName<<  " " << currSeq.size() << " " << lastSeqGr << endl;
-				if (i==0)
-					continue;
+		mChunker.record(chunkBases);
+		myChunkP->queued = pipeline_stats::clockT::now();
+		mStats->busy(READ_STAGE, myChunkP->created, myChunkP->queued, myChunkP->created);
+		myChunkP->task = aReader.task.order;
+		myChunkP->seq = aReader.taskChunks++;
+		aReader.chunk = myChunkP;
+		return true;
+	}
+	return false;
+}
 
-				graph_queue.push(myChunkP);
+// a finished chunk makes room for the parked readers
+void MinHashEncoder::chunkDone(){
+	{
+		std::lock_guard<std::mutex> lk(mut_readers);
+		chunks_in_flight--;
+	}
+	wakeReaders();
+}
 
-				//log output
-				//if (mInstanceCounter%1000000 <=currBuff){
-				//	cout << endl << "seqs read " << file_seqs << " instances read " << mInstanceCounter << " " << myChunkP->size() << " buffer " << currBuff << " full..." << graph_queue.size() << " " << currSeq.size()<< " "<< currSeqName << endl;
-				//}
+// the parked readers try again, those that still cannot go on park again
+void MinHashEncoder::wakeReaders(){
+	vector<ReaderP> readers;
+	{
+		std::lock_guard<std::mutex> lk(mut_readers);
+		readers.swap(parked_readers);
+	}
+	for (unsigned i=0; i<readers.size(); i++)
+		mTasks.submit(std::bind(&MinHashEncoder::task_readFiles, this, readers[i]));
+}
 
-				cv2.notify_all();
-				if (graph_queue.size()>=numWorkers*10){
-					unique_lock<mutex> lk(mut2);
-					cv2.wait(lk,[&]{if ((done) || (graph_queue.size()<=numWorkers*3)) return true; else return false;});
-					lk.unlock();
-				}
-				cv2.notify_all();
-			} // while eof
-			fin.close();
-			files_done++;
-			//cout << endl << "file " << files_done << " seqs " << file_seqs << " " << mInstanceCounter << " " << mSignatureCounter << " instances produced from file " << file_instances << endl;
-		}
+// starts the readers on the queued read tasks, each chunk they read goes to mChunkTask,
+// and waits until all tasks are done
+void MinHashEncoder::RunReaders(unsigned aNumReaders){
+	// enough chunks to keep all threads busy while a few wait for a serial stage
+	max_in_flight = mTasks.size() * 4 + aNumReaders;
+	chunks_in_flight = 0;
+	parked_readers.clear();
+	readers_active = aNumReaders;
+	// BGZF inflaters of the readers, together about one per pool thread
+	mInflateThreads = std::max((unsigned)1, mTasks.size() / aNumReaders);
+
+	const char* stages[] = {"read", "signature", "index", "finish", "output"};
+	mStats.reset(new pipeline_stats(vector<string>(stages, stages + 5)));
+	mStats->add_gauge("in_flight", [this]{ return (uint64_t) chunks_in_flight; });
+	mStats->add_gauge("parked_readers", [this]{ std::lock_guard<std::mutex> lk(mut_readers); return (uint64_t) parked_readers.size(); });
+	mStats->add_gauge("tasks_queued", [this]{ return (uint64_t) mTasks.num_queued(); });
+	mStats->add_gauge("finish_queue", [this]{ return (uint64_t) mFinishStage.size(); });
+	addStatsGauges(*mStats);
+	uint64_t idle = mTasks.idle_ns();
+	mStats->start(mpParameters->mStatsFile, mpParameters->mStatsInterval, mStatsRuns++);
+
+	for (unsigned i=0; i<aNumReaders; i++)
+		mTasks.submit(std::bind(&MinHashEncoder::task_readFiles, this, std::make_shared<ReaderT>()));
+	try {
+		mTasks.wait();
+	} catch (...) {
+		mStats->stop();
+		throw;
 	}
+	mStats->stop();
+	mStatsIdle = mTasks.idle_ns() - idle;
+	if (readers_active > 0)
+		throw range_error("ERROR MinHashEncoder::RunReaders: readers stalled with " + std::to_string(chunks_in_flight) + " chunks in flight");
 }
 
-void MinHashEncoder::worker_Graph2Signature(int numWorkers){
 
-	while (!done){
+// puts all files, large uncompressed FASTA files in parts, into the read queue and returns the
+// number of reader threads to start; instance ids must not depend on which reader takes a task,
+// so seq name/feature ids are assigned in file order up front and window ids keep a single reader
+unsigned MinHashEncoder::QueueReadTasks(SeqFilesT& myFiles){
 
-		ChunkP myData;
-		unique_lock<mutex> lk(mut2);
-		cv2.wait(lk,[&]{if ( (done) ||  (graph_queue.try_pop( (myData) )) ) return true; else return false;});
-		lk.unlock();
+	unsigned numReaders = std::max((unsigned)1, mpParameters->mNumReaders);
+	for (unsigned i=0;i<myFiles.size(); i++){
+		bool orderedIds = myFiles[i]->signatureAction != CLASSIFY && (myFiles[i]->groupGraphsBy == SEQ_WINDOW || myFiles[i]->groupGraphsBy == NONE);
+		if (numReaders > 1 && (orderedIds || myFiles[i]->filetype != FASTA || myFiles[i]->filename_mate != "")){
+			cout << "Instance ids/names of " << myFiles[i]->filename << " follow the read order, using 1 reader thread" << endl;
+			numReaders = 1;
+		}
+	}
 
-		if (!done && myData->size()>0) {
-			//cout << "  graph2sig thread got chunk " << myData->size() << " offset " << myData->offset << " " << mpParameters->mHashBitSize << endl;
+	vector<ReadTaskT> tasks;
+	for (unsigned i=0;i<myFiles.size(); i++){
+		SeqFileP myData = myFiles[i];
+		ReadTaskT myTask;
+		myTask.seqFile = myData;
+		myTask.begin = 0;
+		myTask.end = 0;
+		myTask.part = 0;
+		myTask.seqNames = std::make_shared<SeqNamesT>();
+
+		if (numReaders == 1 || myData->filename == "" || !mpData->IsRegularFile(myData->filename) || mpData->IsGzipFile(myData->filename)){
+			tasks.push_back(myTask);
+			continue;
+		}
 
-			for (unsigned j = 0; j < myData->size(); j++) {
+		// a few parts per reader even out records of different length
+		vector<uint64_t> bounds;
+		mpData->SplitFastaFile(myData->filename, numReaders*4, bounds);
+		for (unsigned k=0; k+1<bounds.size(); k++){
+			myTask.begin = bounds[k];
+			myTask.end = bounds[k+1];
+			myTask.part = k;
+			tasks.push_back(myTask);
+		}
+	}
 
-				generate_feature_vector((*myData)[j].seq, (*myData)[j].svec);
-				ComputeHashSignature((*myData)[j].svec,(*myData)[j].sig);
-			}
-			sig_queue.push(myData);
-			if (sig_queue.size()>=numWorkers*50){
-				unique_lock<mutex> lk(mut2);
-				cv2.wait(lk,[&]{if ((done) || (sig_queue.size()<=numWorkers*3)) return true; else return false;});
-				lk.unlock();
+	// same ids as a single reader assigns them, in order of the files, their seqs and BED entries
+	for (unsigned i=0;i<myFiles.size() && tasks.size()>1; i++){
+		SeqFileP myData = myFiles[i];
+		if (myData->filename == "" || myData->signatureAction == CLASSIFY || (myData->groupGraphsBy != SEQ_NAME && myData->groupGraphsBy != SEQ_FEATURE))
+			continue;
+		vector<string> names;
+		mpData->LoadFastaNames(myData->filename, names);
+		for (unsigned j=0; j<names.size(); j++){
+			vector<string> features;
+			if (myData->dataBED){
+				unsigned first = 0, last = 0;
+				myData->dataBED->Find(names[j], first, last);
+				for (unsigned k = first; k < last; k++)
+					features.push_back(myData->groupGraphsBy == SEQ_FEATURE ? myData->dataBED->Name(k) : names[j]);
+			} else
+				features.push_back(names[j]);
+			for (unsigned k=0; k<features.size(); k++){
+				if (mFeature2IndexValue.find(features[k]) == mFeature2IndexValue.end()){
+					myData->lastMetaIdx++;
+					mFeature2IndexValue.insert(make_pair(features[k],myData->lastMetaIdx));
+				}
 			}
-
 		}
-		cv2.notify_all();
-		cv3.notify_all();
 	}
+
+	for (unsigned i=0;i<tasks.size(); i++){
+		tasks[i].order = i;
+		readFile_queue.push(tasks[i]);
+	}
+	return numReaders;
 }
 
-void MinHashEncoder::finisher(){
-	ProgressBar progress_bar(1000);
-	while (!done){
+void MinHashEncoder::task_Graph2Signature(ChunkP myData){
 
-		ChunkP myData;
-		unique_lock<mutex> lk(mut3);
-		cv3.wait(lk,[&]{if ( (done) || (sig_queue.try_pop( (myData) ))) return true; else return false;});
-		lk.unlock();
+	WorkerBuffersT& buf = mWorkerBuffers[mTasks.thread_index()];
 
-		if (!done && myData->size()>0) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	uint64_t bases = 0;
+	for (unsigned j = 0; j < myData->size(); j++) {
 
-			uint chunkSize = myData->size();
+		ComputeHashSignature((*myData)[j], (*myData)[j].sig, buf.features, buf.featureCache);
+		bases += (*myData)[j].len;
+	}
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+	mChunker.report(bases, std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+	mStats->busy(SIGNATURE_STAGE, start, end, myData->queued);
+	myData->queued = end;
+}
 
-			// virtual function call that can be overloaded in child classes to do specific stuff
-			finishUpdate(myData);
-			myData.reset();
-			mSignatureCounter += chunkSize;
+// one shard of the index update, the last shard that is done with the chunk hands it to the finisher
+void MinHashEncoder::task_UpdateShard(ChunkP myData, unsigned aShard, ProgressBar& progress_bar){
+	mShardStages[aShard]->push(std::move(myData), [this,aShard,&progress_bar](ChunkP& aData){
+		pipeline_stats::clockT::time_point start = pipeline_stats::clockT::now();
+		updateShard(aData, aShard);
+		mStats->busy(INDEX_STAGE, start, pipeline_stats::clockT::now(), aData->queued);
+		if (--aData->shardsLeft > 0) {
+			aData.reset();
+			return;
+		}
+		aData->queued = pipeline_stats::clockT::now();
+		mFinishStage.push(std::move(aData), [this,&progress_bar](ChunkP& aDone){ finisher(aDone, progress_bar, true); });
+	});
+}
 
-		//	if (mInstanceCounter%10 <= 1) {
-				cout.setf(ios::fixed); //,ios::floatfield);
-				cout << "\r" <<  std::setprecision(1) << progress_bar.getElapsed()/1000 << " sec elapsed    Finised numSeqs=" << std::setprecision(0) << setw(10);
-				cout << mSequenceCounter  << "("<<mSequenceCounter/(progress_bar.getElapsed()/1000) <<" seq/s)  signatures=" << setw(10);
-				cout << mSignatureCounter << "("<<(double)mSignatureCounter/((progress_bar.getElapsed()/1000)) <<" sig/s - inst=";
-				cout << mInstanceCounter << " graphQueue=" << graph_queue.size() << " sigQueue=" << sig_queue.size() << "      ";
-		//	}
-			//if (mInstanceCounter%1000000 <= chunkSize){
-			//	cout << endl << "    finisher updated index with " << chunkSize << " signatures all_sigs=" <<  mSignatureCounter << " inst=" << mInstanceCounter << " sigQueue=" << sig_queue.size() << endl;
-			//}
+void MinHashEncoder::finisher(ChunkP& myData, ProgressBar& progress_bar, bool aIndexUpdated){
+
+	uint chunkSize = myData->size();
+	pipeline_stats::clockT::time_point start = pipeline_stats::clockT::now();
+
+	// virtual function call that can be overloaded in child classes to do specific stuff
+	if (!aIndexUpdated)
+		finishUpdate(myData);
+	mStats->busy(FINISH_STAGE, start, pipeline_stats::clockT::now(), myData->queued);
+	mStats->done(myData->created);
+	mChunkPool.put(myData);
+	mSignatureCounter += chunkSize;
+
+//	if (mInstanceCounter%10 <= 1) {
+		cout.setf(ios::fixed); //,ios::floatfield);
+		cout << "\r" <<  std::setprecision(1) << progress_bar.getElapsed()/1000 << " sec elapsed    Finised numSeqs=" << std::setprecision(0) << setw(10);
+		cout << mSequenceCounter  << "("<<mSequenceCounter/(progress_bar.getElapsed()/1000) <<" seq/s)  signatures=" << setw(10);
+		cout << mSignatureCounter << "("<<(double)mSignatureCounter/((progress_bar.getElapsed()/1000)) <<" sig/s - inst=";
+		cout << mInstanceCounter << " inFlight=" << chunks_in_flight << " finishQueue=" << mFinishStage.size() << "      ";
+//	}
 
-//			progress_bar.Count(mInstanceCounter);
-		}
-		cv1.notify_all();
-		cv2.notify_all();
-		cvm.notify_all();
-	}
+//		progress_bar.Count(mInstanceCounter);
+	chunkDone();
 }
 
 void MinHashEncoder::LoadData_Threaded(SeqFilesT& myFiles){
 
-	for (unsigned i=0;i<myFiles.size(); i++){
-		readFile_queue.push(myFiles[i]);
-	}
+	unsigned numReaders = QueueReadTasks(myFiles);
 	cout << "Using " << mpParameters->mHashBitSize << " bits to encode features" << endl;
 	cout << "Using " << mpParameters->mRandomSeed << " as random seed" << endl;
 	cout << "Using " << mpParameters->mNumHashFunctions << " hash functions (with factor " << mpParameters->mNumRepeatsHashFunction << " for single minhash)" << endl;
@@ -403,48 +1073,47 @@ void MinHashEncoder::LoadData_Threaded(SeqFilesT& myFiles){
 
 	cout << "Computing MinHash signatures on the fly while reading " << myFiles.size() << " file(s)..." << endl;
 
-	// threaded producer-consumer model for signature creation and index update
-	// created threads:
-	// 	1 finisher that updates the index and signature cache,
-	// 	1 to read files and produces sequence instances
-	//		n worker threads that create the signatures
-
-	int graphWorkers = std::thread::hardware_concurrency();
-	if (mpParameters->mNumThreads>0)
-		graphWorkers = mpParameters->mNumThreads;
-
-	cout << "Using " << graphWorkers << " worker threads and 2 helper threads..." << endl;
+	// tasks on the scheduler threads:
+	//		num_readers readers that read files and produce chunks of sequence instances,
+	//		one task per chunk that creates the signatures,
+	//		the finisher (serial) that updates the index and signature cache,
+	//		or with index shards one serial update stage per shard before the finisher
+	const unsigned numShards = indexShards();
+	cout << "Using " << mTasks.size() << " threads for all stages, " << numReaders << " reader(s)";
+	if (numShards > 0)
+		cout << ", " << numShards << " index shards";
+	cout << "..." << endl;
+	mShardStages.clear();
+	for (unsigned s=0; s<numShards; s++)
+		mShardStages.emplace_back(new serial_stage<ChunkP>());
 
-	done = false;
 	files_done=0;
 	mSignatureCounter = 0;
 	mInstanceCounter = 0;
 	mSequenceCounter = 0;
-
-	vector<std::thread> threads;
-	threads.push_back( std::thread(&MinHashEncoder::finisher,this));
-	for (int i=0;i<graphWorkers;i++){
-		threads.push_back( std::thread(&MinHashEncoder::worker_Graph2Signature,this,graphWorkers));
-	}
-	threads.push_back( std::thread(&MinHashEncoder::worker_readFiles,this,graphWorkers));
+	mDroppedReads = 0;
+	mChunker.init(mpParameters->mChunkMinBases, mpParameters->mChunkMaxBases, mpParameters->mChunkTargetMs);
 
 	{
-		join_threads joiner(threads);
-
-		unique_lock<mutex> lk(mutm);
-		cv1.notify_all();
-		while(!done){
-			cvm.wait(lk,[&]{if ( (files_done<myFiles.size()) || (mSignatureCounter < mInstanceCounter)) return false; else return true;});
-			lk.unlock();
-			done=true;
-			cv3.notify_all();
-			cv2.notify_all();
-			cv1.notify_all();
-		}
-
-	} // by leaving this block threads get joined by destruction of joiner
+		ProgressBar progress_bar(1000);
+		mChunkTask = [this,&progress_bar,numShards](ChunkP myData){
+			task_Graph2Signature(myData);
+			if (numShards == 0) {
+				mFinishStage.push(std::move(myData), [this,&progress_bar](ChunkP& aData){ finisher(aData, progress_bar); });
+				return;
+			}
+			// the shards are tasks of their own, idle threads take them
+			myData->shardsLeft = numShards;
+			for (unsigned s=1; s<numShards; s++)
+				mTasks.submit(std::bind(&MinHashEncoder::task_UpdateShard, this, myData, s, std::ref(progress_bar)));
+			task_UpdateShard(std::move(myData), 0, progress_bar);
+		};
+		RunReaders(numReaders);
+		mChunkTask = nullptr;
+		mShardStages.clear();
+		cout << endl;
+	}
 
-	// threads finished
 	if (numKeys>0)
 		cout << endl << "Inverse index ratio of overfull bins (maxSizeBin): " << ((double)numFullBins)/((double)numKeys) << " "<< numFullBins << "/" << numKeys << " instances " << mInstanceCounter << endl;
 
@@ -452,6 +1121,9 @@ void MinHashEncoder::LoadData_Threaded(SeqFilesT& myFiles){
 		throw range_error("ERROR in MinHashEncoder::LoadData: something went wrong; no instances/signatures produced");
 	} else
 		cout << "Instances/signatures produced " << mInstanceCounter << endl;
+	cout << "Chunks: " << mChunker.stats() << endl;
+	cout << "Chunk pool: " << mChunkPool.num_created() << " allocated, " << mChunkPool.num_reused() << " reused" << endl;
+	cout << mStats->summary(mTasks.size(), mStatsIdle);
 }
 
 
@@ -460,55 +1132,109 @@ unsigned MinHashEncoder::GetLoadedInstances() {
 }
 
 
-void MinHashEncoder::ComputeHashSignature(const SVector& aX, Signature& signature) {
+void MinHashEncoder::ComputeHashSignature(const FeatureSetT& aX, Signature& signature) {
 
-	unsigned numHashFunctionsFull = mpParameters->mNumHashFunctions * mpParameters->mNumHashShingles;
-	unsigned sub_hash_range = numHashFunctionsFull / mpParameters->mNumRepeatsHashFunction;
+	InitHashSignature(signature);
+	//prepare a vector containing the signature as the k min values
+	//for each feature
+	for (unsigned f = 0; f < aX.ids.size(); ++f)
+		UpdateHashSignature(aX.ids[f], signature);
+	FinishHashSignature(signature);
+}
 
-	//if we use shingles we need a temp signature of length numHashFunctionsFull
-	// otherwise we directly put values in the provided signature object
-	Signature *signatureP;
-	if (mpParameters->mNumHashShingles>1){
-		signatureP = new Signature(numHashFunctionsFull);
+// signature of one instance; in fused mode the features go straight into the
+// signature while they are generated and are never collected in aFeatures
+void MinHashEncoder::ComputeHashSignature(const InstanceT& aInstance, Signature& signature, FeatureSetT& aFeatures, FeatureCacheT& aCache) {
+	if (mpParameters->mFusedMinHash) {
+		InitHashSignature(signature);
+		generate_feature_vector(aInstance, aFeatures, aCache, &signature);
+		FinishHashSignature(signature);
 	} else {
-		signature.resize(numHashFunctionsFull);
-		signatureP = &signature;
+		generate_feature_vector(aInstance, aFeatures, aCache);
+		ComputeHashSignature(aFeatures, signature);
 	}
+}
 
-	//init with MAXUNSIGNED
-	for (unsigned k = 0; k < numHashFunctionsFull; ++k)
-		(*signatureP)[k] = MAXUNSIGNED;
+// the signature holds the minima of all numHashFunctions*numHashShingles slots
+// until FinishHashSignature, init all with MAXUNSIGNED
+void MinHashEncoder::InitHashSignature(Signature& signature) {
+	unsigned numHashFunctionsFull = mpParameters->mNumHashFunctions * mpParameters->mNumHashShingles;
+	signature.assign(numHashFunctionsFull, MAXUNSIGNED);
+}
 
-	//prepare a vector containing the signature as the k min values
-	//for each element of the sparse vector
-	for (SVector::InnerIterator it(aX); it; ++it) {
-		unsigned feature_id = it.index();
-		//for each sub_hash
-		for (unsigned l = 1; l <= mpParameters->mNumRepeatsHashFunction; ++l) {
-			unsigned key = IntHash(feature_id, mHashBitMask, l);
-			for (unsigned kk = 0; kk < sub_hash_range; ++kk) { //for all k values
-				unsigned lower_bound = mHashBitMask / sub_hash_range * kk;
-				unsigned upper_bound = mHashBitMask / sub_hash_range * (kk + 1);
-				// upper bound can be different from MAXUNSIGNED due to rounding effects, correct this
-				if (kk+1==sub_hash_range) upper_bound=mHashBitMask;
-				if (key >= lower_bound && key < upper_bound) { //if we are in the k-th slot
-					unsigned signature_feature = kk + (l - 1) * sub_hash_range;
-					if (key < (*signatureP)[signature_feature]) //keep the min hash within the slot
-						(*signatureP)[signature_feature] = key;
-					//cout << MAXUNSIGNED << " "<< mpParameters->mNumRepeatsHashFunction << " " << sub_hash_range << " " << lower_bound <<" " << upper_bound << " " << signature_feature << " " << l << " " << kk << " " <<  key<< endl;
+inline void MinHashEncoder::UpdateHashSignature(unsigned feature_id, Signature& signature) {
+
+	unsigned numHashFunctionsFull = mpParameters->mNumHashFunctions * mpParameters->mNumHashShingles;
+
+	if (mpParameters->mSignatureEngineCode == OPH) {
+		// one permutation hashing: the high part of the hash selects the bin,
+		// the low part is the value that competes for the min within the bin
+		uint64_t h = (uint64_t) IntHashMix(feature_id, mpParameters->mRandomSeed) * numHashFunctionsFull;
+		unsigned bin = h >> 32;
+		unsigned key = ((unsigned) h >> (32 - mpParameters->mHashBitSize)) & mHashBitMask;
+		if (key < signature[bin])
+			signature[bin] = key;
+		return;
+	}
+
+	unsigned sub_hash_range = numHashFunctionsFull / mpParameters->mNumRepeatsHashFunction;
+	unsigned slot_size = mHashBitMask / sub_hash_range;
+
+	//for each sub_hash, the keys are computed for blocks of sub_hashes at once
+	const unsigned blockSize = 32;
+	unsigned keys[blockSize];
+	for (unsigned first = 0; first < mpParameters->mNumRepeatsHashFunction; first += blockSize) {
+		unsigned num = min(blockSize, mpParameters->mNumRepeatsHashFunction - first);
+		mHashFamily.Hash(feature_id, first, num, keys);
+		for (unsigned l = 0; l < num; ++l) {
+			unsigned key = keys[l];
+			// slot kk holds keys in [slot_size*kk, slot_size*(kk+1)), the last slot
+			// takes the rounding rest up to (excluding) mHashBitMask
+			if (key >= mHashBitMask)
+				continue;
+			unsigned kk = min(key / slot_size, sub_hash_range - 1);
+			unsigned signature_feature = kk + (first + l) * sub_hash_range;
+			if (key < signature[signature_feature]) //keep the min hash within the slot
+				signature[signature_feature] = key;
+		}
+	}
+}
+
+void MinHashEncoder::FinishHashSignature(Signature& signature) {
+
+	// optimal densification (Shrivastava 2017): an empty bin takes the value of the first
+	// non empty bin on its own pseudo random probe sequence, so equal sets stay equal
+	if (mpParameters->mSignatureEngineCode == OPH) {
+		const unsigned numBins = signature.size();
+		unsigned numFilled = 0;
+		for (unsigned i = 0; i < numBins; i++)
+			if (signature[i] != MAXUNSIGNED)
+				numFilled++;
+		if (numFilled > 0 && numFilled < numBins) {
+			// probes look at the bins before densification, a copy per thread keeps them
+			static thread_local Signature filled;
+			filled.assign(signature.begin(), signature.end());
+			for (unsigned i = 0; i < numBins; i++) {
+				if (filled[i] != MAXUNSIGNED)
+					continue;
+				for (unsigned attempt = 1;; attempt++) {
+					unsigned j = ((uint64_t) IntHashMix(i, mpParameters->mRandomSeed + attempt) * numBins) >> 32;
+					if (filled[j] != MAXUNSIGNED) {
+						signature[i] = filled[j];
+						break;
+					}
 				}
 			}
 		}
 	}
 
 	// compute shingles, i.e. rehash mNumHashShingles hash values into one hash value
+	// in place, shingle i is read from positions >= i before position i is written
 	if (mpParameters->mNumHashShingles > 1 ) {
-		vector<unsigned> signatureFinal(mpParameters->mNumHashFunctions);
 		for (unsigned i=0;i<mpParameters->mNumHashFunctions;i++){
-			signatureFinal[i] = HashFunc(signatureP->begin()+(i*mpParameters->mNumHashShingles),signatureP->begin()+(i*mpParameters->mNumHashShingles+mpParameters->mNumHashShingles),mHashBitMask);
+			signature[i] = HashFunc(signature.begin()+(i*mpParameters->mNumHashShingles),signature.begin()+(i*mpParameters->mNumHashShingles+mpParameters->mNumHashShingles),mHashBitMask);
 		}
-		signature.swap(signatureFinal);
-		delete signatureP;
+		signature.resize(mpParameters->mNumHashFunctions);
 	}
 }
 
@@ -726,8 +1452,17 @@ HistogramIndex::binKeyTy HistogramIndex::GetHistogramSize(){
 //}
 
 void HistogramIndex::UpdateInverseIndex(const vector<unsigned>& aSignature, const unsigned& aIndex) {
+	// several classify workers may insert index signatures at the same time
+	lock_guard<mutex> lk(mut_index);
+	UpdateInverseIndex(aSignature, aIndex, 0, mpParameters->mNumHashFunctions);
+}
+
+// hash functions aFirst..aLast-1 only, without the lock: the caller owns these tables (index shard)
+void HistogramIndex::UpdateInverseIndex(const vector<unsigned>& aSignature, const unsigned& aIndex, unsigned aFirst, unsigned aLast) {
+	if (!mIndexReplicas.empty())
+		throw range_error("ERROR HistogramIndex::UpdateInverseIndex: the index is replicated per NUMA node and cannot be changed");
 	const binKeyTy& aIndexT =(binKeyTy)aIndex;
-	for (unsigned k = 0; k < mpParameters->mNumHashFunctions; ++k) { //for every hash value
+	for (unsigned k = aFirst; k < aLast; ++k) { //for every hash value
 		const unsigned& key = aSignature[k];
 		if (key != MAXUNSIGNED && key != 0) { //if key is equal to markers for empty bins then skip insertion instance in data structure
 			if (!mInverseIndex[k][key]) { //if this is the first time that an instance exhibits that specific value for that hash function, then store for the first time the reference to that instance
@@ -743,14 +1478,15 @@ void HistogramIndex::UpdateInverseIndex(const vector<unsigned>& aSignature, cons
 				//mInverseIndex[k][key][0] < 2 &&
 				binKeyTy*& myValue = mInverseIndex[k][key];
 
-				// find pos for insert, assume sorted array
+				// find pos for insert, assume sorted array; values below the first entry go
+				// to the front, so the bin does not depend on the order of the inserts
 				binKeyTy i = myValue[0];
-				while ((myValue[i]> aIndexT) && (i>1)){
+				while ((i>0) && (myValue[i]> aIndexT)){
 					i--;
 				}
 
 				// only insert if element is not there
-				if (myValue[i]<aIndexT){
+				if (i==0 || myValue[i]<aIndexT){
 					binKeyTy newSize = (myValue[0])+1;
 					binKeyTy * fooNew;
 					fooNew = new binKeyTy[newSize+1];
@@ -763,12 +1499,6 @@ void HistogramIndex::UpdateInverseIndex(const vector<unsigned>& aSignature, cons
 					delete[] myValue;
 					myValue = fooNew;
 				}
-				//				cout << "bin " << key << " k " <<  k << " aIdx "<< aIndex << "\t";
-				//				for (unsigned j=0; j<=mInverseIndex[k][key][0];j++){
-				//					cout << mInverseIndex[k][key][j] <<"\t";
-				//				}
-				//				cout << endl;
-
 			}
 		}
 	}
@@ -806,12 +1536,15 @@ void HistogramIndex::ComputeHistogram(const vector<unsigned>& aSignature, std::v
 	hist.resize(GetHistogramSize());
 	hist *= 0;
 	emptyBins = 0;
+	const indexTy& index = GetActiveIndex();
 	for (unsigned k = 0; k < aSignature.size(); ++k) {
-		if (mInverseIndex[k][aSignature[k]]) {
+		// find instead of operator[], lookups must not insert empty bins (called from several threads)
+		indexSingleTy::const_iterator itBin = index[k].find(aSignature[k]);
+		if (itBin != index[k].end() && itBin->second) {
 
 			std::valarray<double> t(0.0, hist.size());
 
-			indexBinTy& myValue = mInverseIndex[k][aSignature[k]];
+			const indexBinTy& myValue = itBin->second;
 
 			for (uint i=1;i<=myValue[0];i++){
 				t[myValue[i]-1]=1;
@@ -825,9 +1558,93 @@ void HistogramIndex::ComputeHistogram(const vector<unsigned>& aSignature, std::v
 	}
 }
 
+// the replica of the node of the calling thread with numa REPLICATE
+const HistogramIndex::indexTy& HistogramIndex::GetActiveIndex() {
+	return mIndexReplicas.empty() ? mInverseIndex : mIndexReplicas[ThreadNode()];
+}
+
+// deep copy, the bins are allocated by the calling thread
+void HistogramIndex::CopyIndex(const indexTy& aFrom, indexTy& oTo) {
+	oTo.clear();
+	oTo.resize(aFrom.size(), indexSingleTy(0));
+	for (unsigned k = 0; k < aFrom.size(); ++k) {
+		oTo[k].max_load_factor(0.9);
+		oTo[k].resize(aFrom[k].size());
+		for (indexSingleTy::const_iterator it = aFrom[k].begin(); it != aFrom[k].end(); ++it) {
+			if (!it->second)
+				continue;
+			binKeyTy* bin = new binKeyTy[it->second[0] + 1];
+			memcpy(bin, it->second, (it->second[0] + 1) * sizeof(binKeyTy));
+			oTo[k][it->first] = bin;
+		}
+	}
+}
+
+void HistogramIndex::FreeIndex(indexTy& aIndex) {
+	for (unsigned k = 0; k < aIndex.size(); ++k)
+		for (indexSingleTy::iterator it = aIndex[k].begin(); it != aIndex[k].end(); ++it)
+			delete[] it->second;
+	indexTy().swap(aIndex);
+}
+
+// numa INTERLEAVE copies the index with its pages spread over all nodes, REPLICATE makes one
+// copy per node on a pool thread of the node; the copies replace the index that was
+// built or read by whatever thread happened to do it
+void HistogramIndex::PlaceIndex() {
+	if (mpParameters->mNumaCode == NUMA_OFF)
+		return;
+	TimerClass T;
+	const bool replicate = mpParameters->mNumaCode == NUMA_REPLICATE;
+	const unsigned numCopies = replicate ? mTopology.num_nodes() : 1;
+	vector<indexTy> copies(numCopies);
+	std::atomic_uint placed(0);
+	unsigned made = 0;
+	for (unsigned n = 0; n < numCopies; n++) {
+		task_pool::taskT copy = [this, n, replicate, &copies, &placed]{
+			if (replicate ? mTopology.bind_memory(n) : mTopology.interleave_memory())
+				placed++;
+			try {
+				CopyIndex(mInverseIndex, copies[n]);
+			} catch (...) {
+				numa_topology::default_memory();
+				throw;
+			}
+			numa_topology::default_memory();
+		};
+		// first pool thread of node n, nodes without one never look at their copy
+		unsigned t = std::find(mThreadNode.begin(), mThreadNode.end(), n) - mThreadNode.begin();
+		if (!replicate)
+			mTasks.submit(copy);
+		else if (t < mThreadNode.size())
+			mTasks.submit_to(t, copy);
+		else
+			continue;
+		made++;
+	}
+	mTasks.wait();
+
+	FreeIndex(mInverseIndex);
+	if (mpParameters->mNumaCode == NUMA_REPLICATE)
+		mIndexReplicas.swap(copies);
+	else
+		mInverseIndex.swap(copies[0]);
+	cout << "Inverse index " << (mpParameters->mNumaCode == NUMA_REPLICATE ? "replicated on " : "interleaved over ") << mTopology.num_nodes() << " NUMA node(s) in " << std::setprecision(2) << T.getElapsed() / 1000 << " sec";
+	if (placed < made)
+		cout << " (memory policy not available, pages stay where they are touched first)";
+	cout << endl;
+}
+
 void HistogramIndex::writeBinaryIndex2(ostream &out, const indexTy& index) {
 	// create binary reverse index representation
 	// format:
+	unsigned tag = BHI_FORMAT_TAG;
+	unsigned engine = mpParameters->mSignatureEngineCode;
+	unsigned family = mpParameters->mHashFamilyCode;
+	unsigned canonical = mpParameters->mCanonicalStrand;
+	out.write((const char*) &tag, sizeof(unsigned));
+	out.write((const char*) &engine, sizeof(unsigned));
+	out.write((const char*) &family, sizeof(unsigned));
+	out.write((const char*) &canonical, sizeof(unsigned));
 	out.write((const char*) &mpParameters->mHashBitSize, sizeof(unsigned));
 	out.write((const char*) &mpParameters->mRandomSeed, sizeof(unsigned));
 	out.write((const char*) &mpParameters->mRadius, sizeof(unsigned));
@@ -856,18 +1673,25 @@ void HistogramIndex::writeBinaryIndex2(ostream &out, const indexTy& index) {
 
 	unsigned numHashFunc = index.size();
 	out.write((const char*) &numHashFunc, sizeof(unsigned));
+	// bins are written by binId, so the file does not depend on the hash map layout
+	// and a sharded build gives the same bytes as a serial one
+	vector<pair<unsigned,binKeyTy*> > bins;
 	for (typename indexTy::const_iterator it = index.begin(); it!= index.end(); it++){
 		unsigned numBins = it->size();
 		out.write((const char*) &numBins, sizeof(unsigned));
-		for (typename indexSingleTy::const_iterator itBin = it->begin(); itBin!=it->end(); itBin++){
-			unsigned binId = itBin->first;
-
-			unsigned numBinEntries = itBin->second[0];
+		bins.clear();
+		for (typename indexSingleTy::const_iterator itBin = it->begin(); itBin!=it->end(); itBin++)
+			bins.push_back(make_pair((unsigned)itBin->first, itBin->second));
+		sort(bins.begin(), bins.end());
+		for (unsigned b = 0; b < bins.size(); b++){
+			unsigned binId = bins[b].first;
+
+			unsigned numBinEntries = bins[b].second[0];
 			out.write((const char*) &binId, sizeof(unsigned));
 			out.write((const char*) &numBinEntries, sizeof(unsigned));
 
 			for (binKeyTy i=1;i<=numBinEntries;i++){
-				binKeyTy s = itBin->second[i];
+				binKeyTy s = bins[b].second[i];
 				out.write((const char*) &(s), sizeof(binKeyTy));
 			}
 		}
@@ -878,7 +1702,24 @@ bool HistogramIndex::readBinaryIndex2(string filename, indexTy &index){
 	igzstream fin;
 	fin.open(filename.c_str());
 	unsigned tmp;
-	fin.read((char*) &mpParameters->mHashBitSize, sizeof(unsigned));
+	// the signature settings of the index replace the given ones, files without
+	// them were built with the MINHASH engine and the LEGACY hash family
+	unsigned engine = MINHASH;
+	unsigned family = LEGACY_HASH;
+	unsigned canonical = 0;
+	fin.read((char*) &tmp, sizeof(unsigned));
+	if (tmp == BHI_FORMAT_TAG) {
+		fin.read((char*) &engine, sizeof(unsigned));
+		fin.read((char*) &family, sizeof(unsigned));
+		fin.read((char*) &canonical, sizeof(unsigned));
+		fin.read((char*) &mpParameters->mHashBitSize, sizeof(unsigned));
+	} else
+		mpParameters->mHashBitSize = tmp;
+	if (engine > OPH || family > TABULATION)
+		fin.setstate(std::ios::badbit);
+	mpParameters->mSignatureEngineCode = (SignatureEngineType) engine;
+	mpParameters->mHashFamilyCode = (HashFamilyType) family;
+	mpParameters->mCanonicalStrand = canonical;
 	fin.read((char*) &mpParameters->mRandomSeed, sizeof(unsigned));
 	fin.read((char*) &mpParameters->mRadius, sizeof(unsigned));
 	fin.read((char*) &mpParameters->mMinRadius, sizeof(unsigned));
@@ -890,6 +1731,8 @@ bool HistogramIndex::readBinaryIndex2(string filename, indexTy &index){
 	fin.read( reinterpret_cast<char*>( &mpParameters->mIndexSeqShift ), sizeof mpParameters->mIndexSeqShift);
 	fin.read((char*) &tmp, sizeof(unsigned));
 	SetHistogramSize(tmp);
+	mHashFamily.Init(mpParameters->mHashFamilyCode, mpParameters->mNumRepeatsHashFunction, mpParameters->mHashBitSize, mpParameters->mRandomSeed);
+	InitPairKernel();
 
 	mFeature2IndexValue.clear();
 	for (unsigned idx=1;idx<=GetHistogramSize();idx++){
@@ -6,6 +6,9 @@
 #include <valarray>
 #include <list>
 #include <chrono>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 #include "Utility.h"
 #include "Parameters.h"
 #include "Data.h"
@@ -45,6 +48,7 @@ public:
 
 	struct SeqFileS {
 		string filename;
+		string filename_mate;	// second mates of paired-end reads, read in lockstep with filename
 		string filename_BED;
 		string filename_index;
 		InputFileType filetype;
@@ -55,39 +59,167 @@ public:
 		SigCacheP sigCache;
 		Data::BEDdataP	dataBED;
 		unsigned lastMetaIdx;
-		ogzstream* out_results_fh;
+		ostream* out_results_fh;
 	};
 
 	typedef SeqFileS 							SeqFileT;
 	typedef std::shared_ptr<SeqFileT> 	SeqFileP;
 	typedef vector<SeqFileP> 				SeqFilesT;
 
-	typedef Eigen::SparseVector<unsigned> SVector;
+	typedef std::tr1::unordered_map<string, uint8_t>	SeqNamesT;
+
+	// one file or one part of a file for the reader threads, parts start at a record boundary
+	struct readTaskS {
+		SeqFileP		seqFile;
+		uint64_t		begin;
+		uint64_t		end;	// 0 reads the whole (possibly gzipped) file
+		unsigned		part;
+		unsigned		order;	// position of the task in the input
+		std::shared_ptr<SeqNamesT>	seqNames;	// names seen in the file, shared by all its parts
+	};
+
+	typedef readTaskS ReadTaskT;
+
+//	typedef Eigen::SparseVector<unsigned> SVector;
 //	typedef google::dense_hash_set<unsigned> SVectorMap;
 
+	// feature ids of one instance, the interface between feature generation and MinHash;
+	// each worker thread keeps one and reuses its buffers for all instances
+	struct featureSetS {
+			vector<unsigned>	ids;	// sorted and unique after Finalize()
+			vector<unsigned>	tmp;	// radix sort buffer
+
+			void Clear() { ids.clear(); }
+			void Add(unsigned aId) { ids.push_back(aId); }
+			void Finalize();
+		};
+
+	typedef featureSetS FeatureSetT;
+
 
 	struct instanceS {
 			Signature 	sig;
-			string 		name;
 			unsigned 	idx;
-			unsigned 	pos;
-			string 		seq;
-			SVector 		svec;
+			unsigned 	pos;	// window start in seq
+			unsigned 	len;	// window length
+			unsigned	seqIdx;	// name of the parent sequence (or read pair) in the chunk
+			const PackedSeq*	seq;	// full parent sequence, held by the chunk
 			bool			rc;
-			SeqFileP 	seqFile;
 		};
 
 	typedef instanceS InstanceT;
-	typedef vector<InstanceT> ChunkT;
+
+	// instances handed from a reader to the workers, numbered within their read task;
+	// chunks come from mChunkPool and go back after the last stage, so the instances keep
+	// their signature buffers. Sequences and names are stored once per parent sequence
+	struct chunkS {
+			unsigned	task;
+			unsigned	seq;
+			SeqFileP	seqFile;	// all instances come from one read task
+			pipeline_stats::clockT::time_point	created;	// reading began
+			pipeline_stats::clockT::time_point	queued;		// handed to the next stage
+			std::atomic_uint	shardsLeft;	// index shards that have not taken the chunk yet
+			chunkS():task(0),seq(0),shardsLeft(0),num(0) {};
+			unsigned size() const { return num; }
+			InstanceT& operator[](unsigned i) { return inst[i]; }
+			const InstanceT& operator[](unsigned i) const { return inst[i]; }
+			InstanceT& Add(const PackedSeqP& aSeq, const string& aName, bool aMate = false);
+			string Name(unsigned i) const;
+			bool SameSeq(unsigned i, unsigned j) const { return inst[i].seqIdx == inst[j].seqIdx; }
+			void clear();
+		private:
+			vector<InstanceT>	inst;	// the first num are in use
+			unsigned			num;
+			vector<PackedSeqP>	seqs;
+			string				names;	// name of seq s is [nameEnd[s-1],nameEnd[s])
+			vector<unsigned>	nameEnd;
+		};
+
+	typedef chunkS ChunkT;
 	typedef std::shared_ptr<ChunkT> ChunkP;
 
+	// NSPDK codes of one encoded window, kept by a worker thread so that
+	// the next overlapping window of the same sequence can reuse them
+	struct featureWindowS {
+			string 				seq;
+			unsigned 			pos;
+			vector<unsigned>	codes;	// seq.size() x (radius+1) neighborhood codes
+			vector<unsigned>	pairs;	// seq.size() x (radius,distance) pair features
+			vector<unsigned>	canon;	// strand canonical neighborhood codes (canonical_strand only)
+		};
+
+	typedef featureWindowS FeatureWindowT;
+
+	struct featureCacheS {
+			FeatureWindowT		win[2][2];	// [rc][0] last window, [rc][1] window before
+			FeatureWindowT		next;		// buffers for the window being encoded
+			FeatureWindowT		nextRC;		// buffers for its reverse complement (canonical_strand only)
+		};
+
+	typedef featureCacheS FeatureCacheT;
+
 	struct resultS{
 		string output_line;
 		unsigned numInstances;
 	};
 
 	typedef resultS ResultT;
-	typedef vector<ResultT> ResultChunkT;
+
+	// a reader goes through the read tasks with one scheduler task per chunk,
+	// its position in the current read task is kept here in between
+	struct readerS {
+		ReadTaskT			task;
+		bool				open;
+		unsigned			taskChunks;
+		igzstream			fin_gz;
+		FileRangeBuf		fin_range;
+		istream				fin_part;
+		istream*			fin;
+		MappedFasta			fin_map;
+		bool				mapped;			// the task is read from fin_map instead of fin
+		unsigned			pos;			// current seq start pos (window/shift)
+		unsigned			end;			// current seq end pos, set from BED entry or to full seq end
+		unsigned			idx;			// instance id for the inverse index
+		bool				valid_input;	// false gets the next seq/BED entry
+		unsigned			currSeqStart;	// start of the current region (BED entry or full seq) in currFullSeq
+		unsigned			currSeqSize;	// size of the current region, 0 once all its windows are taken
+		PackedSeqP			currFullSeq;
+		string				currSeqName;
+		Data::RegionsT		lowQual;		// low quality bases of the current FASTQ seq
+		igzstream			fin_mate;		// paired-end input: the second mates
+		PackedSeqP			mateSeq;		// mate of currFullSeq, its windows follow those of currFullSeq
+		Data::RegionsT		mateLowQual;
+		bool				onMate;			// currFullSeq is the second mate
+		unsigned			readWindows;	// windows taken from the current read (pair)
+		unsigned			anno;			// bed entries [anno,annoEnd) of the current seq are still to read
+		unsigned			annoEnd;
+		ChunkP				chunk;			// read but not taken by the workers yet
+		pipeline_stats::clockT::time_point	parked;	// waiting for the later stages since
+		readerS():open(false),taskChunks(0),fin_part(&fin_range),fin(&fin_gz),mapped(false),onMate(false),readWindows(0),anno(0),annoEnd(0) {};
+	};
+
+	typedef readerS ReaderT;
+	typedef std::shared_ptr<ReaderT> ReaderP;
+
+	// per scheduler thread buffers of the signature tasks
+	struct workerBuffersS {
+		FeatureCacheT	featureCache;
+		FeatureSetT		features;
+	};
+
+	typedef workerBuffersS WorkerBuffersT;
+
+	// results of one chunk, or with taskEnd the number of chunks (seq) its read task made
+	struct resultChunkS : public vector<ResultT> {
+			unsigned	task;
+			unsigned	seq;
+			bool		taskEnd;
+			pipeline_stats::clockT::time_point	created;	// of the chunk
+			pipeline_stats::clockT::time_point	queued;
+			resultChunkS():task(0),seq(0),taskEnd(false) {};
+		};
+
+	typedef resultChunkS ResultChunkT;
 	typedef std::shared_ptr<ResultChunkT> ResultChunkP;
 
 	Parameters* mpParameters;
@@ -99,54 +231,107 @@ public:
 
 protected:
 
-	unsigned numKeys;
+	std::atomic_uint numKeys;
 	unsigned numFullBins;
 
-	multimap<uint, Data::BEDentryP> mIndexValue2Feature;
-	map<string, uint> mFeature2IndexValue;
-
-	mutable std::mutex mutm;
-	mutable std::mutex mut1;
-	mutable std::mutex mut2;
-	mutable std::mutex mut3;
+	// neighborhood hashing for a range of start positions, picked for the cpu in Init
+	typedef void (*NSPDKKernelT)(const char* aSeq, unsigned aSize, unsigned aFirst, unsigned aLast, unsigned aMaxRadius, unsigned aBitMask, bool aRelativeParity, unsigned* aCodes);
+	NSPDKKernelT mNSPDKKernel;
 
-	std::condition_variable cvm;
-	std::condition_variable cv1;
-	std::condition_variable cv2;
-	std::condition_variable cv3;
+	// pair features of a range of start positions, picked for the radius/distance setting in Init
+	typedef void (*PairKernelT)(const unsigned* aCodes, unsigned aSize, unsigned aFirst, unsigned aLast, const unsigned* aSeeds, unsigned aMinRadius, unsigned aRadius, unsigned aMinDistance, unsigned aDistance, unsigned aBitMask, unsigned* oPairs);
+	PairKernelT mPairKernel;
+	vector<unsigned> mPairSeeds;	// per (radius,distance) hash state, see InitPairKernel
 
-	threadsafe_queue<SeqFileP> readFile_queue;
-	threadsafe_queue<ChunkP> graph_queue;
-	threadsafe_queue<ChunkP> sig_queue;
+	// hash functions of the MINHASH signature engine
+	IntHashFamily mHashFamily;
 
-	std::atomic_bool done;
+	multimap<uint, unsigned> mIndexValue2Feature;	// entries of the index BED table
+	map<string, uint> mFeature2IndexValue;
+	std::mutex mut_names;	// guards mFeature2IndexValue and the seen seq names while reading
+
+	// all stages (reading, signatures, index update, output, neighborhood queries) run as tasks
+	// on numThreads threads; read chunks go straight to a signature task, a serial stage
+	// updates the index, readers wait (are parked) while too many chunks are unfinished
+	task_pool mTasks;
+	numa_topology mTopology;
+	vector<unsigned> mThreadNode;	// NUMA node of each pool thread, empty if the threads are not pinned
+	unsigned mInflateThreads;		// BGZF inflater threads per reader, see RunReaders
+	vector<WorkerBuffersT> mWorkerBuffers;
+	serial_stage<ChunkP> mFinishStage;
+	vector<std::unique_ptr<serial_stage<ChunkP> > > mShardStages;	// index update per shard, see indexShards
+	object_pool<ChunkT> mChunkPool;
+	threadsafe_queue<ReadTaskT> readFile_queue;
+	std::function<void(ChunkP)> mChunkTask;	// next stage of a read chunk in the current run
+
+	std::mutex mut_readers;		// guards the parked readers and chunks_in_flight
+	vector<ReaderP> parked_readers;
+	std::atomic_uint chunks_in_flight;	// changed under mut_readers only
+	unsigned max_in_flight;
+
+	adaptive_chunker mChunker;	// chunk sizes of the readers, fed back by the workers
+	std::atomic_uint readers_active;
 	std::atomic_uint files_done;
+	// telemetry of the current run, see RunReaders
+	enum stageE { READ_STAGE, SIGNATURE_STAGE, INDEX_STAGE, FINISH_STAGE, OUTPUT_STAGE };
+	std::unique_ptr<pipeline_stats> mStats;
+	unsigned mStatsRuns;
+	uint64_t mStatsIdle;	// thread idle ns of the pool in the run
 	std::atomic_uint mSequenceCounter;
+	std::atomic_uint mDroppedReads;		// reads (pairs) without any window, e.g. quality trimmed completely
 	std::atomic_uint mInstanceCounter;
 	std::atomic_uint mSignatureCounter;
 
 
 
-	void					worker_Graph2Signature(int numWorkers);
-	void 					finisher();
-	void 					generate_feature_vector(const string& seq, SVector& x);
-	vector<unsigned>	HashFuncNSPDK(const string& aString, unsigned aStart, unsigned aMaxRadius, unsigned aBitMask);
+	void					task_Graph2Signature(ChunkP myData);
+	void 					finisher(ChunkP& myData, ProgressBar& aProgress, bool aIndexUpdated = false);
+	void					task_UpdateShard(ChunkP myData, unsigned aShard, ProgressBar& aProgress);
+	bool					ReadChunk(ReaderT& aReader);
+	void					RunReaders(unsigned aNumReaders);
+	void					chunkDone();
+	void					wakeReaders();
+	void 					generate_feature_vector(const string& seq, FeatureSetT& x, FeatureCacheT& aCache, Signature* aSignature = NULL);
+	void 					generate_feature_vector(const InstanceT& aInstance, FeatureSetT& x, FeatureCacheT& aCache, Signature* aSignature = NULL);
+	void					InitNSPDKKernel();
+	void					InitNuma();
+	unsigned				ThreadNode();
+	void					InitPairKernel();
+	const FeatureWindowT*	FindPreviousWindow(const FeatureWindowT (&aHistory)[2], const FeatureWindowT& aCur, bool aRC, int& oOffset);
+	void					ComputeWindowCodes(FeatureWindowT& aCur, const FeatureWindowT* aPrev, int aOffset);
+	void					HashFuncNSPDK(const string& aString, unsigned aFirst, unsigned aLast, unsigned aMaxRadius, unsigned aBitMask, unsigned* aCodes);
 
 public:
 
 
 	unsigned 			mHashBitMask;
-	void 					worker_readFiles(int numWorkers);
+	void 					task_readFiles(ReaderP aReader);
+	void					ReadMate(ReaderT& aReader, string& ioName);
+	unsigned				QueueReadTasks(SeqFilesT& myFiles);
 	MinHashEncoder(Parameters* apParameters, Data* apData);
 	virtual	~MinHashEncoder();
 	void		Init(Parameters* apParameters, Data* apData);
 
 	virtual void 		UpdateInverseIndex(vector<unsigned>& aSignature, unsigned aIndex) {};
 	virtual void 		finishUpdate(ChunkP& myData) {};
+	// called by the readers before a chunk is queued, false parks the reader until wakeReaders(),
+	// and after the last chunk of a read task
+	virtual bool		beginChunk(unsigned aTask) { return true; };
+	virtual void		endReadTask(unsigned aTask, unsigned aNumChunks) {};
+	virtual void		addStatsGauges(pipeline_stats& aStats) {};
+	// the index can be split in shards of hash functions that are updated in parallel,
+	// each by one serial stage; 0 updates it in finishUpdate
+	virtual unsigned	indexShards() { return 0; };
+	virtual void		updateShard(ChunkP& myData, unsigned aShard) {};
 	void 					LoadData_Threaded(SeqFilesT& myFiles);
 	unsigned				GetLoadedInstances();
 
-	void					ComputeHashSignature(const SVector& aX, Signature& signaure);
+	void					ComputeHashSignature(const FeatureSetT& aX, Signature& signaure);
+	void					ComputeHashSignature(const InstanceT& aInstance, Signature& signature, FeatureSetT& aFeatures, FeatureCacheT& aCache);
+	void					InitHashSignature(Signature& signature);
+	void					UpdateHashSignature(unsigned feature_id, Signature& signature);
+	void					FinishHashSignature(Signature& signature);
+	void					GetInstanceSeq(const InstanceT& aInstance, string& oSeq);
 };
 
 class NeighborhoodIndex : public MinHashEncoder
@@ -222,8 +407,12 @@ public:
 
 	typedef valarray<double> histogramT;
 
+	// first word of a .bhi file that records the signature settings, older files start with the hash bit size
+	static const unsigned BHI_FORMAT_TAG = 0x32494842;
+
 	binKeyTy mHistogramSize;
 	indexTy mInverseIndex;
+	mutable std::mutex mut_index;
 
 	HistogramIndex(Parameters* apParameters, Data* apData)
 		:MinHashEncoder(apParameters,apData)
@@ -239,9 +428,18 @@ public:
 	binKeyTy	GetHistogramSize();
 	void		SetHistogramSize(binKeyTy size);
 	void		UpdateInverseIndex(const vector<unsigned>& aSignature, const unsigned& aIndex);
+	void		UpdateInverseIndex(const vector<unsigned>& aSignature, const unsigned& aIndex, unsigned aFirst, unsigned aLast);
 	void  		ComputeHistogram(const vector<unsigned>& aSignature, std::valarray<double>& hist, unsigned& emptyBins);
 	void		writeBinaryIndex2(ostream &out, const indexTy& index);
 	bool		readBinaryIndex2(string filename, indexTy& index);
+	void		PlaceIndex();
+	const indexTy&	GetActiveIndex();
+
+protected:
+	vector<indexTy> mIndexReplicas;	// one copy of the index per NUMA node with numa REPLICATE
+
+	void		CopyIndex(const indexTy& aFrom, indexTy& oTo);
+	void		FreeIndex(indexTy& aIndex);
 };
 
 #endif /* MIN_HASH_ENCODER_H */
@@ -17,6 +17,9 @@ void ParameterType::Parse(vector<string>& aParameterList) {
 	string str_value = "";
 
 	for (unsigned i = 0; i < aParameterList.size(); ++i) {
+		// without a short switch the short form degenerates to "-", which is a value (stdin/stdout)
+		if (mShortSwitch == "" && aParameterList[i] == shortopt)
+			continue;
 		if (aParameterList[i] == shortopt || aParameterList[i] == longopt || aParameterList[i] == shortopt_min || aParameterList[i] == shortopt_max || aParameterList[i] == longopt_min || aParameterList[i] == longopt_max || aParameterList[i] == shortopt_numsteps || aParameterList[i] == longopt_numsteps) {
 			mIsSet = true;
 			if (mTypeCode != FLAG) {
@@ -258,6 +261,34 @@ void Parameters::SetupOptions() {
 			vec.push_back(&p);
 		}
 	}
+	{
+		ParameterType param;
+		param.mShortSwitch = "";
+		param.mLongSwitch = "results_file";
+		param.mShortDescription = "File for the classification results, gzip compressed if the name ends in .gz; - writes them uncompressed to stdout and all log output to stderr. Default is <input file>.classified.tab.gz in the output directory. An input file - reads stdin (plain or gzip)";
+		param.mTypeCode = STRING;
+		param.mValue = "";
+		mOptionList.insert(make_pair(param.mLongSwitch, param));
+		{
+			vector<ParameterType*>& vec = mActionOptionList[CLASSIFY];
+			ParameterType& p = mOptionList[param.mLongSwitch];
+			vec.push_back(&p);
+		}
+	}
+	{
+		ParameterType param;
+		param.mShortSwitch = "";
+		param.mLongSwitch = "mate_file";
+		param.mShortDescription = "Paired-end input: file with the second mates of the reads in input_data_file_name, in the same order and of the same file_type (FASTA or FASTQ). Mate names may end in /1 and /2. Both mates are classified together and give one result row per pair";
+		param.mTypeCode = STRING;
+		param.mValue = "";
+		mOptionList.insert(make_pair(param.mLongSwitch, param));
+		{
+			vector<ParameterType*>& vec = mActionOptionList[CLASSIFY];
+			ParameterType& p = mOptionList[param.mLongSwitch];
+			vec.push_back(&p);
+		}
+	}
 	{
 		ParameterType param;
 		param.mShortSwitch = "f";
@@ -267,6 +298,7 @@ void Parameters::SetupOptions() {
 		param.mValue = "FASTA";
 		param.mCloseValuesList.push_back("STRINGSEQ");
 		param.mCloseValuesList.push_back("FASTA");
+		param.mCloseValuesList.push_back("FASTQ");
 
 		mOptionList.insert(make_pair(param.mLongSwitch, param));
 
@@ -493,6 +525,87 @@ void Parameters::SetupOptions() {
 			vec.push_back(&p);
 		}
 	}
+	{
+		ParameterType param;
+		param.mShortSwitch = "";
+		param.mLongSwitch = "signature_engine";
+		param.mShortDescription = "How signatures are computed. MINHASH: min of num_repeat_hash_functions hash functions in each slot. OPH: one permutation hashing, each feature is hashed once into one of num_hash_functions*num_hash_shingles bins, empty bins are filled by densification (num_repeat_hash_functions is ignored)";
+		param.mTypeCode = LIST;
+		param.mValue = "MINHASH";
+		param.mCloseValuesList.push_back("MINHASH");
+		param.mCloseValuesList.push_back("OPH");
+		mOptionList.insert(make_pair(param.mLongSwitch, param));
+		{
+			vector<ParameterType*>& vec = mActionOptionList[CLUSTER];
+			ParameterType& p = mOptionList[param.mLongSwitch];
+			vec.push_back(&p);
+		}
+		{
+			vector<ParameterType*>& vec = mActionOptionList[CLASSIFY];
+			ParameterType& p = mOptionList[param.mLongSwitch];
+			vec.push_back(&p);
+		}
+	}
+	{
+		ParameterType param;
+		param.mShortSwitch = "";
+		param.mLongSwitch = "canonical_strand";
+		param.mShortDescription = "Use strand independent features, i.e. a sequence and its reverse complement have the same signature. Classification of both strands then needs only one signature per window. The index has to be built with the same setting.";
+		param.mTypeCode = FLAG;
+		param.mValue = "0";
+		mOptionList.insert(make_pair(param.mLongSwitch, param));
+		{
+			vector<ParameterType*>& vec = mActionOptionList[CLUSTER];
+			ParameterType& p = mOptionList[param.mLongSwitch];
+			vec.push_back(&p);
+		}
+		{
+			vector<ParameterType*>& vec = mActionOptionList[CLASSIFY];
+			ParameterType& p = mOptionList[param.mLongSwitch];
+			vec.push_back(&p);
+		}
+	}
+	{
+		ParameterType param;
+		param.mShortSwitch = "";
+		param.mLongSwitch = "hash_family";
+		param.mShortDescription = "Integer hash functions for the MINHASH signature engine. LEGACY: the original hash, MULTIPLY_SHIFT: multiply-shift hashing, TABULATION: simple tabulation hashing; the functions are seeded with random_seed. An index can only be used with the family it was built with";
+		param.mTypeCode = LIST;
+		param.mValue = "LEGACY";
+		param.mCloseValuesList.push_back("LEGACY");
+		param.mCloseValuesList.push_back("MULTIPLY_SHIFT");
+		param.mCloseValuesList.push_back("TABULATION");
+		mOptionList.insert(make_pair(param.mLongSwitch, param));
+		{
+			vector<ParameterType*>& vec = mActionOptionList[CLUSTER];
+			ParameterType& p = mOptionList[param.mLongSwitch];
+			vec.push_back(&p);
+		}
+		{
+			vector<ParameterType*>& vec = mActionOptionList[CLASSIFY];
+			ParameterType& p = mOptionList[param.mLongSwitch];
+			vec.push_back(&p);
+		}
+	}
+	{
+		ParameterType param;
+		param.mShortSwitch = "";
+		param.mLongSwitch = "fused_minhash";
+		param.mShortDescription = "Update the MinHash signature directly with each feature while it is generated, without collecting the features of an instance first. Gives the same signatures.";
+		param.mTypeCode = FLAG;
+		param.mValue = "0";
+		mOptionList.insert(make_pair(param.mLongSwitch, param));
+		{
+			vector<ParameterType*>& vec = mActionOptionList[CLUSTER];
+			ParameterType& p = mOptionList[param.mLongSwitch];
+			vec.push_back(&p);
+		}
+		{
+			vector<ParameterType*>& vec = mActionOptionList[CLASSIFY];
+			ParameterType& p = mOptionList[param.mLongSwitch];
+			vec.push_back(&p);
+		}
+	}
 	{
 		ParameterType param;
 		param.mShortSwitch = "";
@@ -584,7 +697,7 @@ void Parameters::SetupOptions() {
 		ParameterType param;
 		param.mShortSwitch = "";
 		param.mLongSwitch = "numThreads";
-		param.mShortDescription = "Used number of threads (OpenMP/std::thread) - 0 is max. hardware concurrency";
+		param.mShortDescription = "Number of threads, all stages (reading, signatures, index, neighborhoods, output) run as tasks on them - 0 is max. hardware concurrency. Input files read as a stream (compressed files, pipes) get one extra read-ahead thread each, BGZF files are inflated by up to numThreads further threads shared by the readers";
 		param.mTypeCode = POSITIVE_INTEGER;
 		param.mValue = "0";
 		mOptionList.insert(make_pair(param.mLongSwitch, param));
@@ -604,6 +717,151 @@ void Parameters::SetupOptions() {
 			vec.push_back(&p);
 		}
 	}
+	{
+		ParameterType param;
+		param.mShortSwitch = "";
+		param.mLongSwitch = "num_readers";
+		param.mShortDescription = "Number of readers that parse the input files at the same time (as tasks on the numThreads threads); large uncompressed FASTA files are split at record boundaries and parsed by several readers";
+		param.mTypeCode = POSITIVE_INTEGER;
+		param.mValue = "1";
+		mOptionList.insert(make_pair(param.mLongSwitch, param));
+		{
+			vector<ParameterType*>& vec = mActionOptionList[CLUSTER];
+			ParameterType& p = mOptionList[param.mLongSwitch];
+			vec.push_back(&p);
+		}
+		{
+			vector<ParameterType*>& vec = mActionOptionList[CLASSIFY];
+			ParameterType& p = mOptionList[param.mLongSwitch];
+			vec.push_back(&p);
+		}
+	}
+	{
+		ParameterType param;
+		param.mShortSwitch = "";
+		param.mLongSwitch = "numa";
+		param.mShortDescription = "NUMA placement for classification. OFF: threads and memory are left to the OS. INTERLEAVE: the numThreads threads are pinned round robin to the cpus of the NUMA nodes and the inverse index is spread page by page over all nodes. REPLICATE: threads are pinned the same way and each node gets its own copy of the inverse index (needs the index memory once per node)";
+		param.mTypeCode = LIST;
+		param.mValue = "OFF";
+		param.mCloseValuesList.push_back("OFF");
+		param.mCloseValuesList.push_back("INTERLEAVE");
+		param.mCloseValuesList.push_back("REPLICATE");
+		mOptionList.insert(make_pair(param.mLongSwitch, param));
+		{
+			vector<ParameterType*>& vec = mActionOptionList[CLASSIFY];
+			ParameterType& p = mOptionList[param.mLongSwitch];
+			vec.push_back(&p);
+		}
+	}
+	{
+		ParameterType param;
+		param.mShortSwitch = "";
+		param.mLongSwitch = "index_shards";
+		param.mShortDescription = "Build the inverse index in parallel: the hash functions are split in this many shards, each updated by one thread at a time. 0 = one shard per thread (at most one per hash function), 1 = serial build";
+		param.mTypeCode = POSITIVE_INTEGER;
+		param.mValue = "0";
+		mOptionList.insert(make_pair(param.mLongSwitch, param));
+		{
+			vector<ParameterType*>& vec = mActionOptionList[CLASSIFY];
+			ParameterType& p = mOptionList[param.mLongSwitch];
+			vec.push_back(&p);
+		}
+	}
+	{
+		ParameterType param;
+		param.mShortSwitch = "";
+		param.mLongSwitch = "chunk_target_ms";
+		param.mShortDescription = "Time in ms a worker thread should spend on one chunk of sequence windows, chunk sizes follow the measured worker throughput; 0 uses chunks of chunk_min_bases";
+		param.mTypeCode = POSITIVE_INTEGER;
+		param.mValue = "50";
+		mOptionList.insert(make_pair(param.mLongSwitch, param));
+		{
+			vector<ParameterType*>& vec = mActionOptionList[CLUSTER];
+			ParameterType& p = mOptionList[param.mLongSwitch];
+			vec.push_back(&p);
+		}
+		{
+			vector<ParameterType*>& vec = mActionOptionList[CLASSIFY];
+			ParameterType& p = mOptionList[param.mLongSwitch];
+			vec.push_back(&p);
+		}
+	}
+	{
+		ParameterType param;
+		param.mShortSwitch = "";
+		param.mLongSwitch = "chunk_min_bases";
+		param.mShortDescription = "Smallest chunk of sequence windows handed to a worker thread, in bases";
+		param.mTypeCode = POSITIVE_INTEGER;
+		param.mValue = "20000";
+		mOptionList.insert(make_pair(param.mLongSwitch, param));
+		{
+			vector<ParameterType*>& vec = mActionOptionList[CLUSTER];
+			ParameterType& p = mOptionList[param.mLongSwitch];
+			vec.push_back(&p);
+		}
+		{
+			vector<ParameterType*>& vec = mActionOptionList[CLASSIFY];
+			ParameterType& p = mOptionList[param.mLongSwitch];
+			vec.push_back(&p);
+		}
+	}
+	{
+		ParameterType param;
+		param.mShortSwitch = "";
+		param.mLongSwitch = "chunk_max_bases";
+		param.mShortDescription = "Largest chunk of sequence windows handed to a worker thread, in bases";
+		param.mTypeCode = POSITIVE_INTEGER;
+		param.mValue = "20000000";
+		mOptionList.insert(make_pair(param.mLongSwitch, param));
+		{
+			vector<ParameterType*>& vec = mActionOptionList[CLUSTER];
+			ParameterType& p = mOptionList[param.mLongSwitch];
+			vec.push_back(&p);
+		}
+		{
+			vector<ParameterType*>& vec = mActionOptionList[CLASSIFY];
+			ParameterType& p = mOptionList[param.mLongSwitch];
+			vec.push_back(&p);
+		}
+	}
+	{
+		ParameterType param;
+		param.mShortSwitch = "";
+		param.mLongSwitch = "stats_file";
+		param.mShortDescription = "Write pipeline telemetry to this file: one tab separated line per stats_interval with busy and wait times of the read/signature/index/finish/output stages and the queue depths";
+		param.mTypeCode = STRING;
+		param.mValue = "";
+		mOptionList.insert(make_pair(param.mLongSwitch, param));
+		{
+			vector<ParameterType*>& vec = mActionOptionList[CLUSTER];
+			ParameterType& p = mOptionList[param.mLongSwitch];
+			vec.push_back(&p);
+		}
+		{
+			vector<ParameterType*>& vec = mActionOptionList[CLASSIFY];
+			ParameterType& p = mOptionList[param.mLongSwitch];
+			vec.push_back(&p);
+		}
+	}
+	{
+		ParameterType param;
+		param.mShortSwitch = "";
+		param.mLongSwitch = "stats_interval";
+		param.mShortDescription = "Interval in ms of the lines written to stats_file";
+		param.mTypeCode = POSITIVE_INTEGER;
+		param.mValue = "1000";
+		mOptionList.insert(make_pair(param.mLongSwitch, param));
+		{
+			vector<ParameterType*>& vec = mActionOptionList[CLUSTER];
+			ParameterType& p = mOptionList[param.mLongSwitch];
+			vec.push_back(&p);
+		}
+		{
+			vector<ParameterType*>& vec = mActionOptionList[CLASSIFY];
+			ParameterType& p = mOptionList[param.mLongSwitch];
+			vec.push_back(&p);
+		}
+	}
 	{
 		ParameterType param;
 		param.mShortSwitch = "";
@@ -623,6 +881,56 @@ void Parameters::SetupOptions() {
 			vec.push_back(&p);
 		}
 	}
+	{
+		ParameterType param;
+		param.mShortSwitch = "";
+		param.mLongSwitch = "min_quality";
+		param.mShortDescription = "For FASTQ files only! Bases with a Phred quality (ASCII offset 33) below this are low quality, windows that lie completely in low quality bases are skipped before hashing. A read (pair) left without any window, e.g. trimmed completely, gets no result row and is counted in a warning; 0 = no quality filter";
+		param.mTypeCode = POSITIVE_INTEGER;
+		param.mValue = "0";
+		mOptionList.insert(make_pair(param.mLongSwitch, param));
+		{
+			vector<ParameterType*>& vec = mActionOptionList[CLUSTER];
+			ParameterType& p = mOptionList[param.mLongSwitch];
+			vec.push_back(&p);
+		}
+		{
+			vector<ParameterType*>& vec = mActionOptionList[CLASSIFY];
+			ParameterType& p = mOptionList[param.mLongSwitch];
+			vec.push_back(&p);
+		}
+		{
+			vector<ParameterType*>& vec = mActionOptionList[TEST];
+			ParameterType& p = mOptionList[param.mLongSwitch];
+			vec.push_back(&p);
+		}
+	}
+	{
+		ParameterType param;
+		param.mShortSwitch = "";
+		param.mLongSwitch = "quality_mode";
+		param.mShortDescription = "For FASTQ files only! MASK: low quality bases are read as N. TRIM: low quality bases are cut from both ends of the read";
+		param.mTypeCode = LIST;
+		param.mValue = "MASK";
+		param.mCloseValuesList.push_back("MASK");
+		param.mCloseValuesList.push_back("TRIM");
+		mOptionList.insert(make_pair(param.mLongSwitch, param));
+		{
+			vector<ParameterType*>& vec = mActionOptionList[CLUSTER];
+			ParameterType& p = mOptionList[param.mLongSwitch];
+			vec.push_back(&p);
+		}
+		{
+			vector<ParameterType*>& vec = mActionOptionList[CLASSIFY];
+			ParameterType& p = mOptionList[param.mLongSwitch];
+			vec.push_back(&p);
+		}
+		{
+			vector<ParameterType*>& vec = mActionOptionList[TEST];
+			ParameterType& p = mOptionList[param.mLongSwitch];
+			vec.push_back(&p);
+		}
+	}
 	{
 		ParameterType param;
 		param.mShortSwitch = "";
@@ -661,6 +969,48 @@ void Parameters::SetupOptions() {
 			vec.push_back(&p);
 		}
 	}
+	{
+		ParameterType param;
+		param.mShortSwitch = "";
+		param.mLongSwitch = "result_cache_mb";
+		param.mShortDescription = "Memory in MB for a cache of window results keyed by the window sequence, duplicate reads and windows are classified only once; 0 disables the cache";
+		param.mTypeCode = POSITIVE_INTEGER;
+		param.mValue = "64";
+		mOptionList.insert(make_pair(param.mLongSwitch, param));
+		{
+			vector<ParameterType*>& vec = mActionOptionList[CLASSIFY];
+			ParameterType& p = mOptionList[param.mLongSwitch];
+			vec.push_back(&p);
+		}
+	}
+	{
+		ParameterType param;
+		param.mShortSwitch = "";
+		param.mLongSwitch = "unordered_output";
+		param.mShortDescription = "Write classification results in the order the worker threads finish them instead of input order; faster, nothing is held back";
+		param.mTypeCode = FLAG;
+		param.mValue = "0";
+		mOptionList.insert(make_pair(param.mLongSwitch, param));
+		{
+			vector<ParameterType*>& vec = mActionOptionList[CLASSIFY];
+			ParameterType& p = mOptionList[param.mLongSwitch];
+			vec.push_back(&p);
+		}
+	}
+	{
+		ParameterType param;
+		param.mShortSwitch = "";
+		param.mLongSwitch = "reorder_window";
+		param.mShortDescription = "Number of result chunks that may wait for an earlier chunk to keep the classification output in input order";
+		param.mTypeCode = POSITIVE_INTEGER;
+		param.mValue = "64";
+		mOptionList.insert(make_pair(param.mLongSwitch, param));
+		{
+			vector<ParameterType*>& vec = mActionOptionList[CLASSIFY];
+			ParameterType& p = mOptionList[param.mLongSwitch];
+			vec.push_back(&p);
+		}
+	}
 	{
 		ParameterType param;
 		param.mShortSwitch = "";
@@ -867,6 +1217,9 @@ void Parameters::Init(int argc, const char** argv) {
 	//set the boolean parameters to a default value of false
 	mVerbose = false;
 	mNoIndexCacheFile = false;
+	mFusedMinHash = false;
+	mCanonicalStrand = false;
+	mUnorderedOutput = false;
 	//set the data members of Parameters according to user choice
 	for (map<string, ParameterType>::iterator it = mOptionList.begin(); it != mOptionList.end(); ++it) {
 		ParameterType& param = it->second;
@@ -879,6 +1232,12 @@ void Parameters::Init(int argc, const char** argv) {
 				mWriteApproxNeighbors = true;
 			if (param.mLongSwitch == "no_index_cache_file")
 				mNoIndexCacheFile = true;
+			if (param.mLongSwitch == "fused_minhash")
+				mFusedMinHash = true;
+			if (param.mLongSwitch == "canonical_strand")
+				mCanonicalStrand = true;
+			if (param.mLongSwitch == "unordered_output")
+				mUnorderedOutput = true;
 		}
 
 
@@ -912,8 +1271,28 @@ void Parameters::Init(int argc, const char** argv) {
 			mNumHashShingles = stream_cast<double>(param.mValue);
 		if (param.mLongSwitch == "cluster_type")
 			mClusterType = param.mValue;
+		if (param.mLongSwitch == "signature_engine")
+			mSignatureEngine = param.mValue;
+		if (param.mLongSwitch == "hash_family")
+			mHashFamily = param.mValue;
 		if (param.mLongSwitch == "numThreads")
 			mNumThreads = stream_cast<double>(param.mValue);
+		if (param.mLongSwitch == "num_readers")
+			mNumReaders = stream_cast<unsigned>(param.mValue);
+		if (param.mLongSwitch == "numa")
+			mNuma = param.mValue;
+		if (param.mLongSwitch == "index_shards")
+			mIndexShards = stream_cast<unsigned>(param.mValue);
+		if (param.mLongSwitch == "chunk_target_ms")
+			mChunkTargetMs = stream_cast<unsigned>(param.mValue);
+		if (param.mLongSwitch == "chunk_min_bases")
+			mChunkMinBases = stream_cast<unsigned>(param.mValue);
+		if (param.mLongSwitch == "chunk_max_bases")
+			mChunkMaxBases = stream_cast<unsigned>(param.mValue);
+		if (param.mLongSwitch == "stats_file")
+			mStatsFile = param.mValue;
+		if (param.mLongSwitch == "stats_interval")
+			mStatsInterval = stream_cast<unsigned>(param.mValue);
 		if (param.mLongSwitch == "max_fraction_of_dataset")
 			mMaxFractionOfDataset = stream_cast<double>(param.mValue);
 		if (param.mLongSwitch == "index_bed")
@@ -926,8 +1305,20 @@ void Parameters::Init(int argc, const char** argv) {
 			mIndexSeqShift = stream_cast<double>(param.mValue);
 		if (param.mLongSwitch == "seq_window")
 			mSeqWindow = stream_cast<unsigned>(param.mValue);
+		if (param.mLongSwitch == "results_file")
+			mResultsFile = param.mValue;
+		if (param.mLongSwitch == "mate_file")
+			mMateFileName = param.mValue;
+		if (param.mLongSwitch == "min_quality")
+			mMinQuality = stream_cast<unsigned>(param.mValue);
+		if (param.mLongSwitch == "quality_mode")
+			mQualityMode = param.mValue;
 		if (param.mLongSwitch == "seq_clip")
 			mSeqClip = stream_cast<unsigned>(param.mValue);
+		if (param.mLongSwitch == "result_cache_mb")
+			mResultCacheMB = stream_cast<unsigned>(param.mValue);
+		if (param.mLongSwitch == "reorder_window")
+			mReorderWindow = stream_cast<unsigned>(param.mValue);
 		if (param.mLongSwitch == "min_radius")
 			mMinRadius = stream_cast<unsigned>(param.mValue);
 		if (param.mLongSwitch == "min_distance")
@@ -955,9 +1346,47 @@ void Parameters::Init(int argc, const char** argv) {
 		mFileTypeCode = STRINGSEQ;
 	else if (mFileType == "FASTA")
 		mFileTypeCode = FASTA;
+	else if (mFileType == "FASTQ")
+		mFileTypeCode = FASTQ;
 	else
 		throw range_error("ERROR Parameters::Init: Unrecognized file type: <" + mFileType + ">");
 
+	//convert quality mode string to quality mode code
+	if (mQualityMode == "MASK")
+		mQualityModeCode = QUALITY_MASK;
+	else if (mQualityMode == "TRIM")
+		mQualityModeCode = QUALITY_TRIM;
+	else
+		throw range_error("ERROR Parameters::Init: Unrecognized quality mode: <" + mQualityMode + ">");
+
+	//convert signature engine string to engine code
+	if (mSignatureEngine == "MINHASH")
+		mSignatureEngineCode = MINHASH;
+	else if (mSignatureEngine == "OPH")
+		mSignatureEngineCode = OPH;
+	else
+		throw range_error("ERROR Parameters::Init: Unrecognized signature engine: <" + mSignatureEngine + ">");
+
+	//convert hash family string to family code
+	if (mHashFamily == "LEGACY")
+		mHashFamilyCode = LEGACY_HASH;
+	else if (mHashFamily == "MULTIPLY_SHIFT")
+		mHashFamilyCode = MULTIPLY_SHIFT;
+	else if (mHashFamily == "TABULATION")
+		mHashFamilyCode = TABULATION;
+	else
+		throw range_error("ERROR Parameters::Init: Unrecognized hash family: <" + mHashFamily + ">");
+
+	//convert numa string to numa mode code
+	if (mNuma == "OFF")
+		mNumaCode = NUMA_OFF;
+	else if (mNuma == "INTERLEAVE")
+		mNumaCode = NUMA_INTERLEAVE;
+	else if (mNuma == "REPLICATE")
+		mNumaCode = NUMA_REPLICATE;
+	else
+		throw range_error("ERROR Parameters::Init: Unrecognized numa mode: <" + mNuma + ">");
+
 	//check for help request
 	for (unsigned i = 0; i < options.size(); ++i) {
 		if (options[i] == "-h" || options[i] == "--help") {
@@ -977,4 +1406,15 @@ void Parameters::Init(int argc, const char** argv) {
 	//check that set parameters are compatible
 	if (mInputDataFileName == "")
 		throw range_error("ERROR Parameters::Init: -i <input data file name> is missing.");
+	if (mMateFileName != "" && mFileTypeCode == STRINGSEQ)
+		throw range_error("ERROR Parameters::Init: mate_file needs file_type FASTA or FASTQ.");
+	if (mInputDataFileName == "-" && mMateFileName == "-")
+		throw range_error("ERROR Parameters::Init: only one of input_data_file_name and mate_file can be read from stdin.");
+
+	// the results go to stdout, everything else that is written to cout to stderr
+	mStdout = NULL;
+	if (mResultsFile == "-" && mActionCode == CLASSIFY)
+		mStdout = cout.rdbuf(cerr.rdbuf());
+	if (mChunkMinBases == 0 || mChunkMinBases > mChunkMaxBases)
+		throw range_error("ERROR Parameters::Init: chunk_min_bases must be > 0 and not larger than chunk_max_bases.");
 }
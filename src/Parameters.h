@@ -18,7 +18,19 @@ enum ActionType {
 };
 
 enum InputFileType {
-	STRINGSEQ, FASTA
+	STRINGSEQ, FASTA, FASTQ
+};
+
+enum QualityModeType {
+	QUALITY_MASK, QUALITY_TRIM
+};
+
+enum SignatureEngineType {
+	MINHASH, OPH
+};
+
+enum NumaModeType {
+	NUMA_OFF, NUMA_INTERLEAVE, NUMA_REPLICATE
 };
 
 //------------------------------------------------------------------------------------------------------------------------
@@ -62,8 +74,14 @@ public:
 	string mAction;
 	ActionType mActionCode;
 	string mInputDataFileName;
+	string mMateFileName;
+	string mResultsFile;
+	std::streambuf* mStdout;	// results_file "-": stdout for the results, log output goes to stderr then
 	string mFileType;
 	InputFileType mFileTypeCode;
+	unsigned mMinQuality;
+	string mQualityMode;
+	QualityModeType mQualityModeCode;
 	unsigned mRadius;
 	unsigned mDistance;
 	unsigned mHashBitSize;
@@ -73,6 +91,15 @@ public:
 
 	bool mVerbose;
 	unsigned mNumThreads;
+	unsigned mNumReaders;
+	string mNuma;
+	NumaModeType mNumaCode;
+	unsigned mChunkTargetMs;
+	unsigned mChunkMinBases;
+	unsigned mChunkMaxBases;
+	string mStatsFile;
+	unsigned mStatsInterval;
+	unsigned mIndexShards;
 
 	unsigned mNumHashFunctions;
 	unsigned mNumRepeatsHashFunction;
@@ -80,6 +107,12 @@ public:
 	double mFractionCenterScan;
 	string mClusterType;
 	unsigned mNumHashShingles;
+	bool mFusedMinHash;
+	bool mCanonicalStrand;
+	string mSignatureEngine;
+	SignatureEngineType mSignatureEngineCode;
+	string mHashFamily;
+	HashFamilyType mHashFamilyCode;
 	double mPureApproximateSim;
 
 	string mDirectoryPath;
@@ -94,6 +127,9 @@ public:
 	double mSeqShift;
 
 	unsigned mSeqClip;
+	unsigned mResultCacheMB;
+	bool mUnorderedOutput;
+	unsigned mReorderWindow;
 	unsigned mMinRadius;
 	unsigned mMinDistance;
 	string mDenseCenterNamesFile;
@@ -10,8 +10,9 @@
 
 
 SeqClassifyManager::SeqClassifyManager(Parameters* apParameters, Data* apData):
-HistogramIndex(apParameters,apData),pb(1000)
+HistogramIndex(apParameters,apData),mResultCache((size_t)apParameters->mResultCacheMB << 20),pb(1000),mOrderedOutput(false)
 {
+	mClassifyBuffers.resize(mTasks.size());
 
 }
 
@@ -90,10 +91,10 @@ void SeqClassifyManager::Exec() {
 	}
 
 	// update IndexValue2Feature map from provided Index BED file
-	for (Data::BEDdataIt it=mIndexDataSet->dataBED->begin(); it!=mIndexDataSet->dataBED->end(); ++it ) {
-		map<string, uint>::iterator It2 = mFeature2IndexValue.find(it->second->NAME);
+	for (unsigned i=0; i<indexBED->Size(); i++) {
+		map<string, uint>::iterator It2 = mFeature2IndexValue.find(indexBED->Name(i));
 		if (It2 != mFeature2IndexValue.end()){
-			mIndexValue2Feature.insert(make_pair(It2->second,it->second));
+			mIndexValue2Feature.insert(make_pair(It2->second,i));
 		}
 	}
 
@@ -102,91 +103,185 @@ void SeqClassifyManager::Exec() {
 		if (mIndexValue2Feature.count(it->second)==0){
 			cout << "Provided index BED file " << indexName << " does not contain feature " << it->first << endl;
 			cout << "Create dummy feature for it! "<<endl;
-			Data::BEDentryP myBED = std::make_shared<Data::BEDentryT>();
-			myBED->SEQ = "UNKNOWN_FEAT_"+ it->first;
-			myBED->START=0;
-			myBED->END=1;
-			myBED->NAME=it->first;
-			myBED->SCORE=0;
-			myBED->STRAND='.';
-			myBED->COLS.push_back("DUMMY_BED_ENTRY_FOR_FEATURE_"+it->first);
-			myBED->COLS.push_back("DUMMY_BED_ENTRY_FOR_FEATURE_"+it->first);
-			mIndexValue2Feature.insert(make_pair(it->second,myBED));
+			vector<string> cols(2,"DUMMY_BED_ENTRY_FOR_FEATURE_"+it->first);
+			unsigned dummy = indexBED->Add("UNKNOWN_FEAT_"+ it->first, 0, 1, it->first, 0, '.', cols);
+			mIndexValue2Feature.insert(make_pair(it->second,dummy));
 		}
 	}
 
+	PlaceIndex();
 	ClassifySeqs();
 }
 
-void SeqClassifyManager::worker_Classify(int numWorkers){
+void SeqClassifyManager::task_Classify(ChunkP myData){
 
-	while (!done){
+	WorkerBuffersT& buf = mWorkerBuffers[mTasks.thread_index()];
+	ClassifyBuffersT& cbuf = mClassifyBuffers[mTasks.thread_index()];
 
-		ChunkP myData;
-		unique_lock<mutex> lk(mut2);
-		cv2.wait(lk,[&]{if ( (done) ||  (graph_queue.try_pop( (myData) )) ) return true; else return false;});
-		lk.unlock();
+	//cout << "  graph2sig thread got chunk " << myData->size() << " offset " << (*myData)[0].idx << " " << mpParameters->mHashBitSize << endl;
 
-		if (!done && myData->size()>0) {
-			//cout << "  graph2sig thread got chunk " << myData->size() << " offset " << (*myData)[0].idx << " " << mpParameters->mHashBitSize << endl;
+	ResultChunkP myResultChunk = std::make_shared<ResultChunkT>();
+	myResultChunk->task = myData->task;
+	myResultChunk->seq = myData->seq;
+	myResultChunk->created = myData->created;
 
-			ResultChunkP myResultChunk = std::make_shared<ResultChunkT>();
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	uint64_t bases = 0;
+	cbuf.hists.resize(myData->size());
+	cbuf.emptyBins.resize(myData->size());
+	for (unsigned j = 0; j < myData->size(); j++) {
 
-			for (unsigned j = 0; j < myData->size(); j++) {
+		if (myData->seqFile->signatureAction == CLASSIFY)
+			ClassifyWindow((*myData)[j], cbuf.hists[j], cbuf.emptyBins[j], cbuf.seq, buf.features, buf.featureCache);
+		else
+			MinHashEncoder::ComputeHashSignature((*myData)[j], (*myData)[j].sig, buf.features, buf.featureCache);
+		bases += (*myData)[j].len;
+	}
+	mChunker.report(bases, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+	finishUpdate(myData,cbuf.hists,cbuf.emptyBins,myResultChunk);
+	myResultChunk->queued = std::chrono::steady_clock::now();
+	mStats->busy(SIGNATURE_STAGE, start, myResultChunk->queued, myData->queued);
+	mChunkPool.put(myData);
+	pushResults(myResultChunk);
+}
 
-				generate_feature_vector((*myData)[j].seq, (*myData)[j].svec);
-				MinHashEncoder::ComputeHashSignature((*myData)[j].svec,(*myData)[j].sig);
+// histogram of one window; windows with the same sequence get the same histogram, so with
+// result_cache_mb > 0 duplicates are looked up by a hash of the sequence and skip
+// feature generation, signature and histogram
+void SeqClassifyManager::ClassifyWindow(InstanceT& aInstance, histogramT& hist, unsigned& emptyBins, string& aSeq, FeatureSetT& aFeatures, FeatureCacheT& aCache){
 
-			}
-			finishUpdate(myData,myResultChunk);
-			//			if (res_queue.size()>=numWorkers*25){
-			//				unique_lock<mutex> lk(mut_res);
-			//				cv_res.wait(lk,[&]{if ((done) || (res_queue.size()<=numWorkers*10)) return true; else return false;});
-			//				lk.unlock();
-			//			}
-			res_queue.push(myResultChunk);
+	if (mpParameters->mResultCacheMB == 0) {
+		MinHashEncoder::ComputeHashSignature(aInstance, aInstance.sig, aFeatures, aCache);
+		ComputeHistogram(aInstance.sig, hist, emptyBins);
+		return;
+	}
+
+	GetInstanceSeq(aInstance, aSeq);
+	seqKeyT key = StringHash128(aSeq);
+	WindowResultT res;
+	if (mResultCache.find(key, res)) {
+		hist.resize(GetHistogramSize(), 0.0);
+		for (unsigned i = 0; i < res.bins.size(); i++)
+			hist[res.bins[i].first] = res.bins[i].second;
+		emptyBins = res.emptyBins;
+		return;
+	}
+
+	MinHashEncoder::ComputeHashSignature(aInstance, aInstance.sig, aFeatures, aCache);
+	ComputeHistogram(aInstance.sig, hist, emptyBins);
+	for (unsigned i = 0; i < hist.size(); i++)
+		if (hist[i] != 0)
+			res.bins.push_back(make_pair(i, hist[i]));
+	res.emptyBins = emptyBins;
+	mResultCache.insert(key, res);
+}
+
+// the time a chunk was held back for the output order counts as its wait_in
+void SeqClassifyManager::WriteResults(ResultChunkP& aResults, ostream* fout_res, ProgressBar& aProgress){
+	pipeline_stats::clockT::time_point start = pipeline_stats::clockT::now();
+	for (unsigned i=0; i<aResults->size(); i++){
+		*fout_res << (*aResults)[i].output_line;
+		mResultCounter += (*aResults)[i].numInstances;
+		if (mResultCounter%1000 <= 10) {
+			cout.setf(ios::fixed); //,ios::floatfield);
+			cout << "\r" <<  std::setprecision(1) << aProgress.getElapsed()/1000 << " sec elapsed    Finised numSeqs=" << std::setprecision(0) << setw(10);
+			cout << mNumSequences  << "("<<mNumSequences/(aProgress.getElapsed()/1000) <<" seq/s)  signatures=" << setw(10);
+			cout << mResultCounter << "("<<(double)mResultCounter/((aProgress.getElapsed()/1000)) <<" sig/s - "<<(double)mResultCounter/((aProgress.getElapsed()/(1000/mTasks.size())))<<" per thread)  inst=";
+			cout << mInstanceCounter << " resQueue=" << mResultStage.size() << " inFlight=" << chunks_in_flight << "       ";
 		}
-		cv2.notify_all();
-		cv_res.notify_all();
 	}
+	mStats->busy(OUTPUT_STAGE, start, pipeline_stats::clockT::now(), aResults->queued);
+	mStats->done(aResults->created);
 }
 
-void SeqClassifyManager::finisher_Results(ogzstream* fout_res){
-	ProgressBar progress_bar(1000);
-	while (!done){
-
-		ResultChunkP myResults;
-		unique_lock<mutex> lk(mut_res);
-		cv_res.wait(lk,[&]{if ( (done) || (res_queue.try_pop( (myResults) ))) return true; else return false;});
-		lk.unlock();
-
-		if (!done && myResults->size()>0) {
-
-			for (unsigned i=0; i<myResults->size(); i++){
-				*fout_res << (*myResults)[i].output_line;
-				mResultCounter += (*myResults)[i].numInstances;
-				if (mResultCounter%1000 <= 10) {
-					cout.setf(ios::fixed); //,ios::floatfield);
-					cout << "\r" <<  std::setprecision(1) << progress_bar.getElapsed()/1000 << " sec elapsed    Finised numSeqs=" << std::setprecision(0) << setw(10);
-					cout << mNumSequences  << "("<<mNumSequences/(progress_bar.getElapsed()/1000) <<" seq/s)  signatures=" << setw(10);
-					cout << mResultCounter << "("<<(double)mResultCounter/((progress_bar.getElapsed()/1000)) <<" sig/s - "<<(double)mResultCounter/((progress_bar.getElapsed()/(1000/mpParameters->mNumThreads)))<<" per thread)  inst=";
-					cout << mInstanceCounter << " resQueue=" << res_queue.size() << " graphQueue=" << graph_queue.size() << "       ";
-				}
-			}
+void SeqClassifyManager::addStatsGauges(pipeline_stats& aStats){
+	aStats.add_gauge("result_queue", [this]{ return (uint64_t) mResultStage.size(); });
+	aStats.add_gauge("order_pending", [this]{ std::lock_guard<std::mutex> lk(mut_order); return (uint64_t) mOrderPending; });
+}
+
+void SeqClassifyManager::pushResults(ResultChunkP aResults){
+	mResultStage.push(std::move(aResults), [this](ResultChunkP& myResults){ finisher_Results(myResults); });
+}
+
+void SeqClassifyManager::finisher_Results(ResultChunkP& myResults){
+	ResultWriterT& w = *mWriter;
+	if (!mOrderedOutput) {
+		WriteResults(myResults, w.out, w.progress);
+		chunkDone();
+		return;
+	}
+
+	if (myResults->taskEnd)
+		w.taskChunks[myResults->task] = myResults->seq;
+	else
+		w.held[make_pair(myResults->task, myResults->seq)] = myResults;
+
+	// mOrderTask only changes here, the readers read it under the lock
+	unsigned task = mOrderTask;
+	while (true) {
+		map<unsigned,unsigned>::iterator itTask = w.taskChunks.find(task);
+		if (itTask != w.taskChunks.end() && itTask->second == w.seq) {
+			w.taskChunks.erase(itTask);
+			task++;
+			w.seq = 0;
+			std::lock_guard<std::mutex> lk(mut_order);
+			mOrderTask = task;
+			continue;
 		}
-		cv1.notify_all();
-		cv2.notify_all();
-		cvm.notify_all();
-		cv_res.notify_all();
+		map<pair<unsigned,unsigned>, ResultChunkP>::iterator it = w.held.find(make_pair(task, w.seq));
+		if (it == w.held.end())
+			break;
+		WriteResults(it->second, w.out, w.progress);
+		w.held.erase(it);
+		w.seq++;
+		std::lock_guard<std::mutex> lk(mut_order);
+		mOrderPending--;
+		if (--mOrderPendingTask[task] == 0)
+			mOrderPendingTask.erase(task);
 	}
-	cout << endl << endl;
+
+	// stall: results are ready but an earlier chunk is still missing
+	w.maxHeld = std::max(w.maxHeld, w.held.size());
+	if (!w.held.empty() && !w.stalled) {
+		w.stalled = true;
+		w.stallStart = std::chrono::steady_clock::now();
+	} else if (w.held.empty() && w.stalled) {
+		w.stalled = false;
+		w.stall += std::chrono::duration<double>(std::chrono::steady_clock::now() - w.stallStart).count();
+	}
+
+	if (myResults->taskEnd)
+		wakeReaders();
+	else
+		chunkDone();
+}
+
+bool SeqClassifyManager::beginChunk(unsigned aTask){
+	if (!mOrderedOutput)
+		return true;
+	std::lock_guard<std::mutex> lk(mut_order);
+	unsigned later = mOrderPending - (mOrderPendingTask.count(mOrderTask) ? mOrderPendingTask[mOrderTask] : 0);
+	if (mOrderPending >= mpParameters->mReorderWindow || (aTask != mOrderTask && later + 1 >= mpParameters->mReorderWindow))
+		return false;
+	mOrderPending++;
+	mOrderPendingTask[aTask]++;
+	return true;
+}
+
+void SeqClassifyManager::endReadTask(unsigned aTask, unsigned aNumChunks){
+	if (!mOrderedOutput)
+		return;
+	// passes the workers, the writer needs it to move on to the next task
+	ResultChunkP myEnd = std::make_shared<ResultChunkT>();
+	myEnd->task = aTask;
+	myEnd->seq = aNumChunks;
+	myEnd->taskEnd = true;
+	pushResults(myEnd);
 }
 
 void SeqClassifyManager::Classify_Signatures(SeqFilesT& myFiles){
 
-	for (unsigned i=0;i<myFiles.size(); i++){
-		readFile_queue.push(myFiles[i]);
-	}
+	unsigned numReaders = QueueReadTasks(myFiles);
 	cout << "Using " << mpParameters->mHashBitSize << " bits to encode features" << endl;
 	cout << "Using " << mpParameters->mRandomSeed << " as random seed" << endl;
 	cout << "Using " << mpParameters->mNumHashFunctions << " hash functions (with factor " << mpParameters->mNumRepeatsHashFunction << " for single minhash)" << endl;
@@ -198,40 +293,31 @@ void SeqClassifyManager::Classify_Signatures(SeqFilesT& myFiles){
 
 	cout << "Computing MinHash signatures on the fly while reading " << myFiles.size() << " file(s)..." << endl;
 
-	int graphWorkers = std::thread::hardware_concurrency();
-	if (mpParameters->mNumThreads>0)
-		graphWorkers = mpParameters->mNumThreads;
-
-	cout << "Using " << graphWorkers << " worker threads and 2 helper threads..." << endl;
+	// tasks on the scheduler threads: readers, one classify task per chunk, the result writer (serial)
+	cout << "Using " << mTasks.size() << " threads for all stages, " << numReaders << " reader(s)..." << endl;
 
-	done = false;
 	files_done=0;
 	mSignatureCounter = 0;
 	mInstanceCounter = 0;
+	mDroppedReads = 0;
 	mResultCounter = 0;
-	vector<std::thread> threads;
 
-	threads.push_back( std::thread(&SeqClassifyManager::finisher_Results,this,myFiles[0]->out_results_fh));
-	for (int i=0;i<graphWorkers;i++){
-		threads.push_back( std::thread(&SeqClassifyManager::worker_Classify,this,graphWorkers));
-	}
-	threads.push_back( std::thread(&SeqClassifyManager::worker_readFiles,this,graphWorkers));
-
-	{
-		join_threads joiner(threads);
-
-		unique_lock<mutex> lk(mutm);
-		cv1.notify_all();
-		while(!done){
-			cvm.wait(lk,[&]{if ( (files_done<myFiles.size()) || (mInstanceCounter > mResultCounter) ) return false; else return true;});
-			lk.unlock();
-			done=true;
-			cv3.notify_all();
-			cv2.notify_all();
-			cv1.notify_all();
-		}
+	mOrderedOutput = !mpParameters->mUnorderedOutput;
+	mOrderTask = 0;
+	mOrderPending = 0;
+	mOrderPendingTask.clear();
+	mChunker.init(mpParameters->mChunkMinBases, mpParameters->mChunkMaxBases, mpParameters->mChunkTargetMs);
+	mWriter.reset(new ResultWriterT(myFiles[0]->out_results_fh));
+	mChunkTask = std::bind(&SeqClassifyManager::task_Classify, this, std::placeholders::_1);
 
-	} // by leaving this block threads get joined by destruction of joiner
+	RunReaders(numReaders);
+
+	mChunkTask = nullptr;
+	cout << endl << endl;
+	if (mOrderedOutput)
+		cout << "Output order: at most " << mWriter->maxHeld << " result chunks held back, " << std::setprecision(3) << mWriter->stall << " sec stalled by out of order chunks" << endl;
+	mWriter.reset();
+	mOrderedOutput = false;
 
 	cout << " sig classifier finished" << endl;
 
@@ -239,6 +325,9 @@ void SeqClassifyManager::Classify_Signatures(SeqFilesT& myFiles){
 		throw range_error("ERROR in MinHashEncoder::LoadData: something went wrong; no instances/signatures produced");
 	} else
 		cout << "Instances/signatures produced " << mInstanceCounter << " " << mResultCounter << endl;
+	cout << "Chunks: " << mChunker.stats() << endl;
+	cout << "Chunk pool: " << mChunkPool.num_created() << " allocated, " << mChunkPool.num_reused() << " reused" << endl;
+	cout << mStats->summary(mTasks.size(), mStatsIdle);
 }
 
 
@@ -258,12 +347,29 @@ void SeqClassifyManager::finishUpdate(ChunkP& myData) {
 	}
 }
 
-void SeqClassifyManager::finishUpdate(ChunkP& myData, ResultChunkP& myResultChunk) {
+unsigned SeqClassifyManager::indexShards() {
+	unsigned n = mpParameters->mIndexShards > 0 ? mpParameters->mIndexShards : mTasks.size();
+	n = std::min(n, mpParameters->mNumHashFunctions);
+	return n > 1 ? n : 0;
+}
+
+// shard aShard holds the hash functions [aShard*F/n, (aShard+1)*F/n), only one thread updates it
+// at a time; the bins are kept sorted on insert so the index does not depend on the chunk order
+void SeqClassifyManager::updateShard(ChunkP& myData, unsigned aShard) {
+	const unsigned n = indexShards();
+	const unsigned F = mpParameters->mNumHashFunctions;
+	const unsigned first = aShard * F / n, last = (aShard + 1) * F / n;
+	for (unsigned j = 0; j < myData->size(); j++) {
+		UpdateInverseIndex((*myData)[j].sig, (*myData)[j].idx, first, last);
+	}
+}
+
+void SeqClassifyManager::finishUpdate(ChunkP& myData, vector<histogramT>& aHists, vector<unsigned>& aEmptyBins, ResultChunkP& myResultChunk) {
 
 	unsigned j = 0;
 	while (j < (*myData).size()) {
 
-		switch ((*myData)[j].seqFile->signatureAction){
+		switch (myData->seqFile->signatureAction){
 		case INDEX:{
 			UpdateInverseIndex((*myData)[j].sig, (*myData)[j].idx);
 			j++;
@@ -282,9 +388,8 @@ void SeqClassifyManager::finishUpdate(ChunkP& myData, ResultChunkP& myResultChun
 			unsigned matchingSigsRC = 0;
 
 			do {
-				valarray<double> hist_tmp; //(0.0,GetHistogramSize());
-				unsigned emptyBins_tmp;
-				ComputeHistogram((*myData)[j+k].sig,hist_tmp,emptyBins_tmp);
+				const valarray<double>& hist_tmp = aHists[j+k];
+				unsigned emptyBins_tmp = aEmptyBins[j+k];
 
 				switch ((*myData)[j+k].rc){
 				case true:
@@ -300,37 +405,37 @@ void SeqClassifyManager::finishUpdate(ChunkP& myData, ResultChunkP& myResultChun
 				}
 				//cout << (*myData)[j+k].name << " " << (*myData)[j+k].rc << endl;
 				k++;
-			} while (j+k<myData->size() && (*myData)[j].name==(*myData)[j+k].name);
+			} while (j+k<myData->size() && myData->SameSeq(j, j+k));
 
 			ResultT myResult;
-			//ogzstream *fout = (*myData)[j].seqFile->out_results_fh;
+			//ogzstream *fout = myData->seqFile->out_results_fh;
 
-			switch ((*myData)[j].seqFile->strandType){
+			switch (myData->seqFile->strandType){
 			case FWD:
 				myResult.numInstances = k;
-				myResult.output_line = getResultString(hist,emptyBins,matchingSigs,k,(*myData)[j].name,FWD);
+				myResult.output_line = getResultString(hist,emptyBins,matchingSigs,k,myData->Name(j),FWD);
 				myResultChunk->push_back(myResult);
 				//*fout << myRes;
 				break;
 			case REV:
 				myResult.numInstances = k;
-				myResult.output_line = getResultString(histRC,emptyBinsRC,matchingSigsRC,k,(*myData)[j].name,REV);
+				myResult.output_line = getResultString(histRC,emptyBinsRC,matchingSigsRC,k,myData->Name(j),REV);
 				myResultChunk->push_back(myResult);
 				//*fout << myRes;
 				break;
 			case FR:
 				myResult.numInstances = k;
-				myResult.output_line = getResultString(hist+histRC,emptyBins+emptyBinsRC,matchingSigs+matchingSigsRC,k,(*myData)[j].name,FR);
+				myResult.output_line = getResultString(hist+histRC,emptyBins+emptyBinsRC,matchingSigs+matchingSigsRC,k,myData->Name(j),FR);
 				myResultChunk->push_back(myResult);
 				//*fout << myRes;
 				break;
 			case FR_sep:
 				myResult.numInstances = k;
-				myResult.output_line = getResultString(hist,emptyBins,matchingSigs,k/2,(*myData)[j].name,FWD);
+				myResult.output_line = getResultString(hist,emptyBins,matchingSigs,k/2,myData->Name(j),FWD);
 				myResultChunk->push_back(myResult);
 				//*fout << myRes;
 				myResult.numInstances = k;
-				myResult.output_line = getResultString(histRC,emptyBinsRC,matchingSigsRC,k/2,(*myData)[j].name,REV);
+				myResult.output_line = getResultString(histRC,emptyBinsRC,matchingSigsRC,k/2,myData->Name(j),REV);
 				myResultChunk->push_back(myResult);
 				//*fout << myRes;
 				break;
@@ -345,20 +450,21 @@ void SeqClassifyManager::finishUpdate(ChunkP& myData, ResultChunkP& myResultChun
 
 			++mNumSequences;
 
-			if (sum!=0)
-				mClassifiedInstances++;
-
 			valarray<double> hist_t = hist;
 			hist_t /= (k*mpParameters->mNumHashFunctions);
 
 			hist_t /= sum;
 			hist_t = hist.apply(changeNAN);
 
-			metaHist += hist_t;
-
 			for (unsigned i = 0; i<hist.size(); i++){
 				if (hist[i] >= max ) {hist[i] = 1;} else { hist[i]=0.0;};
 			}
+
+			// several classify tasks finish chunks at the same time
+			std::lock_guard<std::mutex> lk(mut_meta);
+			if (sum!=0)
+				mClassifiedInstances++;
+			metaHist += hist_t;
 			metaHistNum += hist; //.apply(indicator);
 
 			j += k;
@@ -434,8 +540,9 @@ void SeqClassifyManager::ClassifySeqs(){
 	// prepare sequence set for classification
 	SeqFileP mySet = std::make_shared<SeqFileT>();
 	mySet->filename = mpParameters->mInputDataFileName;
+	mySet->filename_mate = mpParameters->mMateFileName;
 	mySet->filetype = mpParameters->mFileTypeCode;
-	mySet->groupGraphsBy=SEQ_NAME; // actually we check by InstanceT.name field for graphs from one seq
+	mySet->groupGraphsBy=SEQ_NAME; // actually we check by the parent seq of the instances for graphs from one seq
 	mySet->checkUniqueSeqNames = true;
 	mySet->signatureAction	= CLASSIFY;
 	mySet->strandType			= FR;
@@ -460,7 +567,16 @@ void SeqClassifyManager::ClassifySeqs(){
 	//LoadData_Threaded(myList);
 
 	cout << "Classification finished - signatures=" << mSignatureCounter << " instances=" << mNumSequences << " classified=" << mClassifiedInstances<< endl;
-	mySet->out_results_fh->close();
+	if (mDroppedReads > 0)
+		cout << "WARNING: " << mDroppedReads << " read(s) without a window of good quality bases have no result row" << endl;
+	if (mpParameters->mResultCacheMB > 0) {
+		unsigned long lookups = mResultCache.hits + mResultCache.misses;
+		cout << "Result cache: hits=" << mResultCache.hits << " misses=" << mResultCache.misses << " hit rate=" << setprecision(3) << (lookups > 0 ? (double)mResultCache.hits/lookups : 0.0) << " memory=" << setprecision(3) << mResultCache.bytes() / 1048576.0 << "MB (capacity " << mResultCache.capacity() / 1048576 << "MB)" << endl;
+	}
+	// closes the file, stdout is only flushed
+	mySet->out_results_fh->flush();
+	delete mySet->out_results_fh;
+	mySet->out_results_fh = NULL;
 
 	/////////////////////////////////////////////////////////////////////////////
 	// classification finished
@@ -475,11 +591,11 @@ void SeqClassifyManager::ClassifySeqs(){
 	}
 	sort(sortedHist.begin(), sortedHist.end());
 	for (unsigned j=0; j<std::min((unsigned)20,(unsigned)sortedHist.size());j++){
-		multimap<uint, Data::BEDentryP>::iterator it = mIndexValue2Feature.find(sortedHist[j].second+1);
+		multimap<uint, unsigned>::iterator it = mIndexValue2Feature.find(sortedHist[j].second+1);
 		uint num = mIndexValue2Feature.count(sortedHist[j].second+1);
 		cout << setprecision(2) << j+1 << "\t" << -sortedHist[j].first << "\t" << (uint)metaHistNum[sortedHist[j].second] << "\t" << sortedHist[j].second+1 << "\t";
-		if (it != mIndexValue2Feature.end()) cout << "feature\t"<< it->second->NAME << "\t#features=" << num;
-		if (it != mIndexValue2Feature.end() && it->second->COLS.size()>=2) cout << "\t" << it->second->COLS[1];
+		if (it != mIndexValue2Feature.end()) cout << "feature\t"<< mIndexDataSet->dataBED->Name(it->second) << "\t#features=" << num;
+		if (it != mIndexValue2Feature.end() && mIndexDataSet->dataBED->NumCols(it->second)>=2) cout << "\t" << mIndexDataSet->dataBED->Col(it->second,1);
 		cout << endl;
 	}
 	cout << "SUM\t"<< metaHist.sum() << endl << endl;
@@ -490,7 +606,8 @@ void SeqClassifyManager::ClassifySeqs(){
 		indexHist.resize(GetHistogramSize());
 		indexHist *= 0;
 
-		for (typename HistogramIndex::indexTy::const_iterator it = mInverseIndex.begin(); it!= mInverseIndex.end(); it++){
+		const HistogramIndex::indexTy& index = GetActiveIndex();
+		for (typename HistogramIndex::indexTy::const_iterator it = index.begin(); it!= index.end(); it++){
 			for (typename HistogramIndex::indexSingleTy::const_iterator itBin = it->begin(); itBin!=it->end(); itBin++){
 				indexHist[itBin->second[0]-1] += 1;
 			}
@@ -502,14 +619,26 @@ void SeqClassifyManager::ClassifySeqs(){
 	}
 }
 
-ogzstream* SeqClassifyManager::PrepareResultsFile(){
-
-	string resultsName = mpParameters->mInputDataFileName;
-	const unsigned pos = mpParameters->mInputDataFileName.find_last_of("/");
-	if (std::string::npos != pos)
-		resultsName = mpParameters->mInputDataFileName.substr(pos+1);
-
-	ogzstream* fout = new ogzstream((mpParameters->mDirectoryPath+resultsName+".classified.tab.gz").c_str(),std::ios::out);
+ostream* SeqClassifyManager::PrepareResultsFile(){
+
+	ostream* fout;
+	const string& resultsFile = mpParameters->mResultsFile;
+	if (resultsFile == "-") {
+		fout = new ostream(mpParameters->mStdout);
+	} else if (resultsFile != "") {
+		if (resultsFile.size() > 3 && resultsFile.compare(resultsFile.size() - 3, 3, ".gz") == 0)
+			fout = new ogzstream(resultsFile.c_str(),std::ios::out);
+		else
+			fout = new ofstream(resultsFile.c_str());
+	} else {
+		string resultsName = mpParameters->mInputDataFileName == "-" ? "stdin" : mpParameters->mInputDataFileName;
+		const unsigned pos = resultsName.find_last_of("/");
+		if (std::string::npos != pos)
+			resultsName = resultsName.substr(pos+1);
+		fout = new ogzstream((mpParameters->mDirectoryPath+resultsName+".classified.tab.gz").c_str(),std::ios::out);
+	}
+	if (!fout->good())
+		throw range_error("ERROR SeqClassifyManager::PrepareResultsFile: Cannot open results file " + resultsFile);
 	// write header to output results file
 	// parameters
 	*fout << "##INDEX PARAMETERS" << endl;
@@ -533,6 +662,8 @@ ogzstream* SeqClassifyManager::PrepareResultsFile(){
 	*fout << "##CLASSIFY PARAMETERS" << endl;
 	*fout << "##" << endl;
 	*fout << "#PARAM\tINPUTFILE\t" << mpParameters->mInputDataFileName << endl;
+	if (mpParameters->mMateFileName != "")
+		*fout << "#PARAM\tMATEFILE\t" << mpParameters->mMateFileName << endl;
 	*fout << "#PARAM\tSEQSHIFT\t" <<mpParameters->mSeqShift << endl;
 	*fout << "#PARAM\tSEQCLIP\t" <<mpParameters->mSeqClip << endl;
 	*fout << "#PARAM\tAPPROXSIM\t" <<mpParameters->mPureApproximateSim << endl;
@@ -543,8 +674,8 @@ ogzstream* SeqClassifyManager::PrepareResultsFile(){
 	// mapping table histogram idx -> feature
 	for (std::map<string,uint>::iterator it = mFeature2IndexValue.begin(); it != mFeature2IndexValue.end();++it) {
 		*fout << "#HIST_IDX\t"<< it->second << "\t" << "feature\t"<< it->first;
-		multimap<uint,Data::BEDentryP>::iterator it2 = mIndexValue2Feature.find(it->second);
-		if (it2 != mIndexValue2Feature.end() && it2->second->COLS.size()>=2) *fout << "\t" << it2->second->COLS[1];
+		multimap<uint,unsigned>::iterator it2 = mIndexValue2Feature.find(it->second);
+		if (it2 != mIndexValue2Feature.end() && mIndexDataSet->dataBED->NumCols(it2->second)>=2) *fout << "\t" << mIndexDataSet->dataBED->Col(it2->second,1);
 		*fout << endl;
 	}
 	*fout << "##" << endl;
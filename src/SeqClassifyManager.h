@@ -18,32 +18,96 @@
 class SeqClassifyManager: public HistogramIndex {
 
 public:
+	typedef pair<uint64_t, uint64_t> seqKeyT;
+
+	struct seqKeyHashS {
+		size_t operator()(const seqKeyT& aKey) const { return aKey.first; }
+	};
+
+	// histogram of one classified window, only the non zero bins
+	struct windowResultS {
+		vector<pair<unsigned, double> > bins;
+		unsigned emptyBins;
+	};
+
+	typedef windowResultS WindowResultT;
+
+	struct windowResultBytesS {
+		size_t operator()(const WindowResultT& aRes) const { return aRes.bins.capacity() * sizeof(aRes.bins[0]); }
+	};
+
+	// per scheduler thread buffers of the classify tasks
+	struct classifyBuffersS {
+		string				seq;
+		vector<histogramT>	hists;
+		vector<unsigned>	emptyBins;
+	};
+
+	typedef classifyBuffersS ClassifyBuffersT;
+
+	// state of the result writer, a serial stage; in input order results wait in held
+	// until all results before them are written
+	struct resultWriterS {
+		ostream*		out;
+		ProgressBar		progress;
+		map<pair<unsigned,unsigned>, ResultChunkP> held;
+		map<unsigned,unsigned> taskChunks;	// number of chunks of the finished read tasks
+		unsigned		seq;				// next chunk of read task mOrderTask
+		size_t			maxHeld;
+		double			stall;
+		bool			stalled;
+		std::chrono::steady_clock::time_point stallStart;
+		resultWriterS(ostream* aOut):out(aOut),progress(1000),seq(0),maxHeld(0),stall(0),stalled(false) {};
+	};
+
+	typedef resultWriterS ResultWriterT;
+
 	SeqClassifyManager(Parameters* apParameters, Data* apData);
 
+	// window results by hash of the window sequence
+	threadsafe_cache<seqKeyT, WindowResultT, seqKeyHashS, windowResultBytesS> mResultCache;
+
 	std::atomic_uint mNumSequences;
 	valarray<double> metaHist;
 	valarray<double> metaHistNum;
 	unsigned mClassifiedInstances;
+	std::mutex mut_meta;	// guards the meta histograms and mClassifiedInstances
 	ProgressBar pb;
 
 	std::atomic_bool done_output;
 
-	threadsafe_queue<ResultChunkP> res_queue;
-	mutable std::mutex mut_res;
-   std::condition_variable cv_res;
+	vector<ClassifyBuffersT> mClassifyBuffers;
+	serial_stage<ResultChunkP> mResultStage;
+	std::unique_ptr<ResultWriterT> mWriter;	// only while Classify_Signatures runs
 	std::atomic_uint mResultCounter;
 
+	// keeps the output in input order: readers are parked while reorder_window chunks are
+	// queued but not written; later tasks leave one of them to the task being written
+	bool mOrderedOutput;		// only while Classify_Signatures runs
+	std::mutex mut_order;
+	unsigned mOrderTask;		// read task whose results are written next
+	unsigned mOrderPending;		// chunks queued by the readers but not written yet
+	map<unsigned,unsigned> mOrderPendingTask;	// the same per read task
+
 
 	void 			Exec();
 	void 			finishUpdate(ChunkP& myData);
-	void 			finishUpdate(ChunkP& myData, ResultChunkP& myResult);
+	unsigned		indexShards();
+	void			updateShard(ChunkP& myData, unsigned aShard);
+	void 			finishUpdate(ChunkP& myData, vector<histogramT>& aHists, vector<unsigned>& aEmptyBins, ResultChunkP& myResult);
+	void 			ClassifyWindow(InstanceT& aInstance, histogramT& hist, unsigned& emptyBins, string& aSeq, FeatureSetT& aFeatures, FeatureCacheT& aCache);
 
 	void 			ClassifySeqs();
 	void 			Classify_Signatures(SeqFilesT& myFiles);
-	void 			worker_Classify(int numWorkers);
-	void 			finisher_Results(ogzstream* fout_res);
+	void 			task_Classify(ChunkP myData);
+	void			pushResults(ResultChunkP aResults);
+	void 			finisher_Results(ResultChunkP& myResults);
+	bool			beginChunk(unsigned aTask);
+	void			endReadTask(unsigned aTask, unsigned aNumChunks);
+	void			addStatsGauges(pipeline_stats& aStats);
+	void			WriteResults(ResultChunkP& aResults, ostream* fout_res, ProgressBar& aProgress);
 	string		getResultString(histogramT hist,unsigned emptyBins, unsigned matchingSigs, unsigned numSigs, string name, strandTypeT strand);
-	ogzstream* 	PrepareResultsFile();
+	ostream* 	PrepareResultsFile();
 
 	//inline double minSim(double i) { if (i<mpParameters->mPureApproximateSim) return 0; else return i; };
 };
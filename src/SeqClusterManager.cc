@@ -27,20 +27,20 @@ SeqClusterManager::SeqClusterManager(Parameters* apParameters, Data* apData)
 
 void SeqClusterManager::finishUpdate(ChunkP& myData) {
 
-	switch ((*myData)[0].seqFile->signatureAction){
+	switch (myData->seqFile->signatureAction){
 	case INDEX_SIGCACHE: {
 		unsigned chunkSize 	= myData->size();
 		unsigned offset 		= (*myData)[0].idx-1;
 		//cout << "offset " << offset << " chunk " << chunkSize << endl;
-		if ((*myData)[0].seqFile->sigCache->size() < offset + chunkSize) {
-			(*myData)[0].seqFile->sigCache->resize( offset + chunkSize);
+		if (myData->seqFile->sigCache->size() < offset + chunkSize) {
+			myData->seqFile->sigCache->resize( offset + chunkSize);
 			idx2nameMap.resize(offset + chunkSize);
 		}
 
 		for (unsigned j = 0; j < chunkSize; j++) {
-			(*myData)[0].seqFile->sigCache->at(offset+j) = (*myData)[j].sig;
-			name2idxMap.insert(make_pair((*myData)[j].name, offset+j));
-			idx2nameMap.at(offset+j) = (*myData)[j].name;
+			myData->seqFile->sigCache->at(offset+j) = (*myData)[j].sig;
+			name2idxMap.insert(make_pair(myData->Name(j), offset+j));
+			idx2nameMap.at(offset+j) = myData->Name(j);
 		}
 
 		for (unsigned j = 0; j < myData->size(); j++) {
@@ -98,14 +98,12 @@ void SeqClusterManager::DenseCluster() {
 
 	cout << endl << "Compute neighborhood and density for selected " << mDenseCenterIdxList.size() << " instances." << endl;
 	vector<pair<double, unsigned> > DensityList(mDenseCenterIdxList.size());
-	unsigned fullCollisions = 0;
+	std::atomic_uint fullCollisions(0);
 
 	{
 		ProgressBar ppb(1000);
-#ifdef USEMULTITHREAD
-#pragma omp parallel for schedule(dynamic,100)
-#endif
-		for (unsigned i = 0; i < mDenseCenterIdxList.size(); ++i) {
+		// blocks of 100 instances as tasks, idle threads steal blocks from busy ones
+		mTasks.parallel_for(0, mDenseCenterIdxList.size(), 100, [&](size_t i){
 
 			uint ii = mDenseCenterIdxList[i];
 			//compute neighbors
@@ -118,7 +116,7 @@ void SeqClusterManager::DenseCluster() {
 			if (collisions >= mpParameters->mNumHashFunctions) fullCollisions++;
 			//cout << i << " dens " << density << " size " << neighborhood_list.size() << " coll " << collisions <<  endl;
 			ppb.Count();
-		}
+		});
 	}
 	cout << endl << " Instances with complete signature collision (MaxSizeBin): " << fullCollisions << endl;
 
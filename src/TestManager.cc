@@ -71,10 +71,10 @@ void TestManager::Exec() {
 	//	}
 
 	// update IndexValue2Feature map from provided Index BED file
-	for (Data::BEDdataIt it=mIndexDataSet->dataBED->begin(); it!=mIndexDataSet->dataBED->end(); ++it ) {
-		map<string, uint>::iterator It2 = mFeature2IndexValue.find(it->second->NAME);
+	for (unsigned i=0; i<indexBED->Size(); i++) {
+		map<string, uint>::iterator It2 = mFeature2IndexValue.find(indexBED->Name(i));
 		if (It2 != mFeature2IndexValue.end()){
-			mIndexValue2Feature.insert(make_pair(It2->second,it->second));
+			mIndexValue2Feature.insert(make_pair(It2->second,i));
 		}
 	}
 
@@ -83,16 +83,9 @@ void TestManager::Exec() {
 		if (mIndexValue2Feature.count(it->second)==0){
 			cout << "Provided index BED file " << indexName << " does not contain feature " << it->first << endl;
 			cout << "Create dummy feature for it! "<<endl;
-			Data::BEDentryP myBED = std::make_shared<Data::BEDentryT>();
-			myBED->SEQ = "UNKNOWN_FEAT_"+ it->first;
-			myBED->START=0;
-			myBED->END=1;
-			myBED->NAME=it->first;
-			myBED->SCORE=0;
-			myBED->STRAND='.';
-			myBED->COLS.push_back("DUMMY_BED_ENTRY_FOR_FEATURE_"+it->first);
-			myBED->COLS.push_back("DUMMY_BED_ENTRY_FOR_FEATURE_"+it->first);
-			mIndexValue2Feature.insert(make_pair(it->second,myBED));
+			vector<string> cols(2,"DUMMY_BED_ENTRY_FOR_FEATURE_"+it->first);
+			unsigned dummy = indexBED->Add("UNKNOWN_FEAT_"+ it->first, 0, 1, it->first, 0, '.', cols);
+			mIndexValue2Feature.insert(make_pair(it->second,dummy));
 		}
 	}
 
@@ -109,10 +102,15 @@ void TestManager::finishUpdate(ChunkP& myData) {
 
 	unsigned shift = std::max((double)1,(double)mpParameters->mSeqWindow*mpParameters->mSeqShift);
 	uint k = 20;
+	string seq;
+	FeatureSetT features;
+	FeatureCacheT featureCache;
 	for (unsigned j = k; j < myData->size(); j++) {
 
-		for (SVector::InnerIterator it((*myData)[j].svec); it; ++it) {
-			unsigned feature_id = it.index();
+		// chunks do not carry features, compute them again for the dump
+		generate_feature_vector((*myData)[j], features, featureCache);
+		for (unsigned f = 0; f < features.ids.size(); ++f) {
+			unsigned feature_id = features.ids[f];
 				cout << "feat " << feature_id << endl;
 		}
 		for (unsigned b=0; b<=k; b++){
@@ -129,7 +127,8 @@ void TestManager::finishUpdate(ChunkP& myData) {
 				}
 
 			}
-			cout << b << " " << matches << "\t" << (double)matches/mpParameters->mNumHashFunctions << "\t" << nomatch << "\t" << shift*b << "\t" << mpParameters->mSeqWindow << "\t" << (*myData)[j].pos << "\t" << (*myData)[j].name << "\t" << (*myData)[j-b].seq << endl;
+			GetInstanceSeq((*myData)[j-b], seq);
+			cout << b << " " << matches << "\t" << (double)matches/mpParameters->mNumHashFunctions << "\t" << nomatch << "\t" << shift*b << "\t" << mpParameters->mSeqWindow << "\t" << (*myData)[j].pos << "\t" << myData->Name(j) << "\t" << seq << endl;
 		}
 		cout << endl;
 
@@ -226,11 +225,11 @@ void TestManager::ClassifySeqs(){
 	sort(sortedHist.begin(), sortedHist.end());
 
 	for (unsigned j=0; j<sortedHist.size();j++){
-		multimap<uint, Data::BEDentryP>::iterator it = mIndexValue2Feature.find(sortedHist[j].second+1);
+		multimap<uint, unsigned>::iterator it = mIndexValue2Feature.find(sortedHist[j].second+1);
 		uint num = mIndexValue2Feature.count(sortedHist[j].second+1);
 		cout << setprecision(2) << j+1 << "\t" << -sortedHist[j].first << "\t" << setprecision(10) << metaHistNum[sortedHist[j].second] << "\t" << sortedHist[j].second+1 << "\t";
-		if (it != mIndexValue2Feature.end()) cout << "feature\t"<< it->second->NAME << "\t#features=" << num;
-		if (it != mIndexValue2Feature.end() && it->second->COLS.size()>=2) cout << "\t" << it->second->COLS[1];
+		if (it != mIndexValue2Feature.end()) cout << "feature\t"<< mIndexDataSet->dataBED->Name(it->second) << "\t#features=" << num;
+		if (it != mIndexValue2Feature.end() && mIndexDataSet->dataBED->NumCols(it->second)>=2) cout << "\t" << mIndexDataSet->dataBED->Col(it->second,1);
 		cout << endl;
 	}
 	cout << "SUM\t"<< metaHist.sum() << endl << endl;
@@ -277,8 +276,8 @@ ogzstream* TestManager::PrepareResultsFile(){
 	// mapping table histogram idx -> feature
 	for (std::map<string,uint>::iterator it = mFeature2IndexValue.begin(); it != mFeature2IndexValue.end();++it) {
 		*fout << "#HIST_IDX\t"<< it->second << "\t" << "feature\t"<< it->first;
-		multimap<uint,Data::BEDentryP>::iterator it2 = mIndexValue2Feature.find(it->second);
-		if (it2 != mIndexValue2Feature.end() && it2->second->COLS.size()>=2) *fout << "\t" << it2->second->COLS[1];
+		multimap<uint,unsigned>::iterator it2 = mIndexValue2Feature.find(it->second);
+		if (it2 != mIndexValue2Feature.end() && mIndexDataSet->dataBED->NumCols(it2->second)>=2) *fout << "\t" << mIndexDataSet->dataBED->Col(it2->second,1);
 		*fout << endl;
 	}
 	*fout << "#SEQNAME\tHITS\tSUM\tMAX\tIDX\tVALS\tMAX_IDX"<< endl;
@@ -1,4 +1,10 @@
 #include "Utility.h"
+#ifdef __linux__
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
 
 
 //void MakeShuffledDataIndicesList(vector<unsigned>& oDataIdList, unsigned aSize) {
@@ -103,6 +109,34 @@ double TimerClass::getElapsed(){
 	return elapsed.count();
 }
 
+//------------------------------------------------------------------------------------------------------------------------
+//------------------------------------------------------------------------------------------------------------------------
+IntHashFamily::IntHashFamily() :
+		mFamily(LEGACY_HASH), mNumFunctions(0), mHashBitMask(0), mShift(0) {
+}
+
+void IntHashFamily::Init(HashFamilyType aFamily, unsigned aNumFunctions, unsigned aHashBitSize, unsigned aRandomSeed) {
+	mFamily = aFamily;
+	mNumFunctions = aNumFunctions;
+	mHashBitMask = (2 << (aHashBitSize - 1)) - 1;
+	mShift = 32 - aHashBitSize;
+	mMul.clear();
+	mAdd.clear();
+	mTable.clear();
+	// parameters are drawn from a counter based generator, so they only depend on the seed
+	unsigned counter = 0;
+	if (mFamily == MULTIPLY_SHIFT) {
+		for (unsigned l = 0; l < mNumFunctions; l++) {
+			mMul.push_back(IntHashMix(counter++, aRandomSeed) | 1);
+			mAdd.push_back(IntHashMix(counter++, aRandomSeed));
+		}
+	} else if (mFamily == TABULATION) {
+		mTable.resize(4 * 256 * mNumFunctions);
+		for (unsigned i = 0; i < mTable.size(); i++)
+			mTable[i] = IntHashMix(counter++, aRandomSeed);
+	}
+}
+
 //------------------------------------------------------------------------------------------------------------------------
 ProgressBar::ProgressBar(unsigned aStep) :
 		mStep(aStep), mCounter(0) {
@@ -327,4 +361,485 @@ string OutputManager::GetFullPathFileName() {
 	return output_filename;
 }
 
+bool FileRangeBuf::open(const string& aFileName, uint64_t aBegin, uint64_t aEnd) {
+	close();
+	mFile = fopen(aFileName.c_str(), "rb");
+	if (!mFile)
+		return false;
+	if (fseeko(mFile, aBegin, SEEK_SET) != 0) {
+		close();
+		return false;
+	}
+	mLeft = aEnd > aBegin ? aEnd - aBegin : 0;
+	setg(mBuf, mBuf, mBuf);
+	return true;
+}
+
+void FileRangeBuf::close() {
+	if (mFile)
+		fclose(mFile);
+	mFile = NULL;
+	mLeft = 0;
+	setg(mBuf, mBuf, mBuf);
+}
+
+FileRangeBuf::int_type FileRangeBuf::underflow() {
+	if (gptr() < egptr())
+		return traits_type::to_int_type(*gptr());
+	if (!mFile || mLeft == 0)
+		return traits_type::eof();
+	size_t n = fread(mBuf, 1, std::min((uint64_t)sizeof(mBuf), mLeft), mFile);
+	if (n == 0)
+		return traits_type::eof();
+	mLeft -= n;
+	setg(mBuf, mBuf, mBuf + n);
+	return traits_type::to_int_type(*gptr());
+}
+
+void adaptive_chunker::init(uint64_t aMinSize, uint64_t aMaxSize, unsigned aTargetMs) {
+	std::lock_guard<std::mutex> lk(mut);
+	min_size = std::max((uint64_t)1, aMinSize);
+	max_size = std::max(min_size, aMaxSize);
+	target_ns = aTargetMs * 1e6;
+	rate = 0;
+	fed_size = fed_ns = 0;
+	num_chunks = sum_size = largest = last_size = 0;
+	smallest = std::numeric_limits<uint64_t>::max();
+}
+
+uint64_t adaptive_chunker::next_size() const {
+	std::lock_guard<std::mutex> lk(mut);
+	if (target_ns == 0 || rate == 0)
+		return min_size;
+	return std::min(max_size, std::max(min_size, (uint64_t)(rate * target_ns)));
+}
+
+void adaptive_chunker::record(uint64_t aSize) {
+	std::lock_guard<std::mutex> lk(mut);
+	num_chunks++;
+	sum_size += aSize;
+	smallest = std::min(smallest, aSize);
+	largest = std::max(largest, aSize);
+	last_size = aSize;
+}
+
+void adaptive_chunker::report(uint64_t aSize, uint64_t aNs) {
+	std::lock_guard<std::mutex> lk(mut);
+	fed_size += aSize;
+	fed_ns += aNs;
+	// single tiny chunks are too noisy, wait for a quarter of the target time
+	if (fed_ns == 0 || fed_ns < target_ns / 4)
+		return;
+	double r = (double)fed_size / fed_ns;
+	rate = rate == 0 ? r : 0.75 * rate + 0.25 * r;
+	fed_size = fed_ns = 0;
+}
+
+string adaptive_chunker::stats() const {
+	std::lock_guard<std::mutex> lk(mut);
+	stringstream out;
+	out << "chunks=" << num_chunks << " bases min/avg/max=" << (num_chunks ? smallest : 0) << "/" << (num_chunks ? sum_size / num_chunks : 0) << "/" << largest;
+	out << " last=" << last_size << " bounds=" << min_size << ".." << max_size;
+	if (target_ns > 0)
+		out << " target=" << target_ns / 1e6 << "ms worker throughput=" << rate * 1e3 << " Mbases/s";
+	else
+		out << " fixed";
+	return out.str();
+}
+
+thread_local task_pool* task_pool::current = NULL;
+thread_local unsigned task_pool::current_index = 0;
+
+task_pool::task_pool(unsigned aNumThreads) :
+		next(0), queued(0), pending(0), sleeping(0), idle(0), lastChange(std::chrono::steady_clock::now()), failed(false), stop(false) {
+	numThreads = aNumThreads > 0 ? aNumThreads : std::max(1u, std::thread::hardware_concurrency());
+	deques.reset(new dequeS[numThreads]);
+	for (unsigned i = 0; i < numThreads; i++)
+		threads.push_back(std::thread(&task_pool::run, this, i));
+}
+
+task_pool::~task_pool() {
+	{
+		std::lock_guard<std::mutex> lk(mut);
+		stop = true;
+	}
+	task_cond.notify_all();
+	for (unsigned i = 0; i < threads.size(); i++)
+		threads[i].join();
+}
+
+unsigned task_pool::thread_index() const {
+	return current == this ? current_index : numThreads;
+}
+
+void task_pool::submit(taskT aTask) {
+	pending++;
+	unsigned i = current == this ? current_index : next++ % numThreads;
+	{
+		std::lock_guard<std::mutex> lk(deques[i].mut);
+		deques[i].tasks.push_back(std::move(aTask));
+	}
+	{
+		std::lock_guard<std::mutex> lk(mut);
+		queued++;
+	}
+	task_cond.notify_one();
+}
+
+void task_pool::submit_to(unsigned aIndex, taskT aTask) {
+	pending++;
+	{
+		std::lock_guard<std::mutex> lk(deques[aIndex].mut);
+		deques[aIndex].own.push_back(std::move(aTask));
+	}
+	{
+		std::lock_guard<std::mutex> lk(mut);
+		deques[aIndex].numOwn++;
+	}
+	// the thread that wakes up must be aIndex
+	task_cond.notify_all();
+}
+
+bool task_pool::pin(unsigned aIndex, unsigned aCpu) {
+	return numa_topology::pin(threads[aIndex].native_handle(), vector<unsigned>(1, aCpu));
+}
+
+long task_pool::num_queued() {
+	std::lock_guard<std::mutex> lk(mut);
+	return std::max(0L, queued);
+}
+
+// called under mut
+void task_pool::count_sleeping(int aChange) {
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	idle += sleeping * std::chrono::duration_cast<std::chrono::nanoseconds>(now - lastChange).count();
+	lastChange = now;
+	sleeping += aChange;
+}
+
+uint64_t task_pool::idle_ns() {
+	std::lock_guard<std::mutex> lk(mut);
+	count_sleeping(0);
+	return idle;
+}
+
+void task_pool::wait() {
+	std::unique_lock<std::mutex> lk(mut);
+	done_cond.wait(lk, [this]{ return pending.load() == 0; });
+	if (failed) {
+		std::exception_ptr e = error;
+		error = std::exception_ptr();
+		failed = false;
+		std::rethrow_exception(e);
+	}
+}
+
+// tasks of submit_to first, then own deque from the back, then the others from the front;
+// sleeps while all are empty
+bool task_pool::take(unsigned aIndex, taskT& oTask) {
+	while (true) {
+		{
+			dequeS& d = deques[aIndex];
+			std::unique_lock<std::mutex> lk(d.mut);
+			if (!d.own.empty()) {
+				oTask = std::move(d.own.front());
+				d.own.pop_front();
+				lk.unlock();
+				std::lock_guard<std::mutex> lkq(mut);
+				d.numOwn--;
+				return true;
+			}
+		}
+		for (unsigned k = 0; k < numThreads; k++) {
+			dequeS& d = deques[(aIndex + k) % numThreads];
+			std::lock_guard<std::mutex> lk(d.mut);
+			if (d.tasks.empty())
+				continue;
+			if (k == 0) {
+				oTask = std::move(d.tasks.back());
+				d.tasks.pop_back();
+			} else {
+				oTask = std::move(d.tasks.front());
+				d.tasks.pop_front();
+			}
+			std::lock_guard<std::mutex> lkq(mut);
+			queued--;
+			return true;
+		}
+		std::unique_lock<std::mutex> lk(mut);
+		count_sleeping(1);
+		task_cond.wait(lk, [this, aIndex]{ return queued > 0 || deques[aIndex].numOwn > 0 || stop; });
+		count_sleeping(-1);
+		if (stop && queued == 0 && deques[aIndex].numOwn == 0)
+			return false;
+	}
+}
+
+void task_pool::run(unsigned aIndex) {
+	current = this;
+	current_index = aIndex;
+	taskT task;
+	while (take(aIndex, task)) {
+		if (!failed) {
+			try {
+				task();
+			} catch (...) {
+				std::lock_guard<std::mutex> lk(mut);
+				if (!failed) {
+					error = std::current_exception();
+					failed = true;
+				}
+			}
+		}
+		task = taskT();
+		if (--pending == 0) {
+			std::lock_guard<std::mutex> lk(mut);
+			done_cond.notify_all();
+		}
+	}
+}
+
+pipeline_stats::pipeline_stats(const vector<string>& aStages) :
+		numStages(aStages.size()), begin(clockT::now()), run(0), stopping(false) {
+	stages.reset(new stageS[numStages + 1]);
+	for (unsigned i = 0; i < numStages; i++)
+		stages[i].name = aStages[i];
+	stages[numStages].name = "pipeline";
+}
+
+pipeline_stats::~pipeline_stats() {
+	stop();
+}
+
+void pipeline_stats::add_gauge(const string& aName, gaugeT aGauge) {
+	gauges.push_back(make_pair(aName, aGauge));
+}
+
+void pipeline_stats::start(const string& aFileName, unsigned aIntervalMs, unsigned aRun) {
+	begin = clockT::now();
+	finish = clockT::time_point();
+	run = aRun;
+	if (aFileName == "")
+		return;
+	out.open(aFileName.c_str(), aRun == 0 ? ios::out : ios::out | ios::app);
+	if (!out)
+		throw range_error("ERROR pipeline_stats: Cannot open stats file: " + aFileName);
+	if (aRun == 0) {
+		out << "run\ttime_s";
+		for (unsigned i = 0; i < numStages; i++)
+			out << "\t" << stages[i].name << "_items\t" << stages[i].name << "_busy_s\t" << stages[i].name << "_wait_in_s\t" << stages[i].name << "_wait_out_s";
+		for (unsigned g = 0; g < gauges.size(); g++)
+			out << "\t" << gauges[g].first;
+		out << "\n";
+	}
+	std::chrono::milliseconds interval(std::max(1u, aIntervalMs));
+	sampler = thread([this, interval]{
+		std::unique_lock<std::mutex> lk(mut);
+		while (!cond.wait_for(lk, interval, [this]{ return stopping; }))
+			sample();
+	});
+}
+
+// last line and the latency histograms, no more samples after this
+void pipeline_stats::stop() {
+	if (finish == clockT::time_point())
+		finish = clockT::now();
+	if (!sampler.joinable())
+		return;
+	{
+		std::lock_guard<std::mutex> lk(mut);
+		stopping = true;
+	}
+	cond.notify_all();
+	sampler.join();
+	sample();
+	for (unsigned i = 0; i <= numStages; i++)
+		out << "#latency_ms\t" << run << "\t" << latency_line(stages[i]) << "\n";
+	out.close();
+}
+
+void pipeline_stats::sample() {
+	out << run << "\t" << ns(begin, clockT::now()) / 1e9;
+	for (unsigned i = 0; i < numStages; i++) {
+		const stageS& s = stages[i];
+		out << "\t" << s.items << "\t" << s.busy_ns / 1e9 << "\t" << s.wait_in_ns / 1e9 << "\t" << s.wait_out_ns / 1e9;
+	}
+	for (unsigned g = 0; g < gauges.size(); g++)
+		out << "\t" << gauges[g].second();
+	out << endl;
+}
+
+uint64_t pipeline_stats::ns(clockT::time_point aFrom, clockT::time_point aTo) {
+	return aTo > aFrom ? std::chrono::duration_cast<std::chrono::nanoseconds>(aTo - aFrom).count() : 0;
+}
+
+void pipeline_stats::add_latency(stageS& aStage, uint64_t aNs) {
+	unsigned b = 0;
+	for (uint64_t ms = aNs / 1000000; ms > 0 && b < NUM_BUCKETS - 1; ms >>= 1)
+		b++;
+	aStage.latency[b]++;
+}
+
+// aQueued is when the item was handed to the stage
+void pipeline_stats::busy(unsigned aStage, clockT::time_point aStart, clockT::time_point aEnd, clockT::time_point aQueued) {
+	stageS& s = stages[aStage];
+	s.items++;
+	s.busy_ns += ns(aStart, aEnd);
+	s.wait_in_ns += ns(aQueued, aStart);
+	add_latency(s, ns(aQueued, aEnd));
+}
+
+// an item left the last stage, aCreated is when its reading began
+void pipeline_stats::done(clockT::time_point aCreated) {
+	stageS& s = stages[numStages];
+	s.items++;
+	add_latency(s, ns(aCreated, clockT::now()));
+}
+
+// name and counts of the latency buckets <1ms <2ms ... >=16s
+string pipeline_stats::latency_line(const stageS& aStage) {
+	stringstream line;
+	line << aStage.name;
+	for (unsigned b = 0; b < NUM_BUCKETS; b++)
+		line << "\t" << aStage.latency[b];
+	return line.str();
+}
+
+string pipeline_stats::summary(unsigned aNumThreads, uint64_t aIdleNs) const {
+	double wall = ns(begin, finish == clockT::time_point() ? clockT::now() : finish) / 1e9;
+	stringstream res;
+	res.setf(ios::fixed);
+	res << "Pipeline: " << std::setprecision(2) << wall << " sec on " << aNumThreads << " threads, idle " << aIdleNs / 1e9 << " thread sec" << endl;
+	res << "  stage          items   busy s  threads  wait_in s wait_out s  latency ms p50/p90/max" << endl;
+	for (unsigned i = 0; i <= numStages; i++) {
+		const stageS& s = stages[i];
+		res << "  " << std::left << setw(10) << s.name << std::right << setw(10) << s.items;
+		if (i < numStages)
+			res << std::setprecision(3) << setw(9) << s.busy_ns / 1e9 << setw(9) << (wall > 0 ? s.busy_ns / 1e9 / wall : 0) << setw(11) << s.wait_in_ns / 1e9 << setw(11) << s.wait_out_ns / 1e9;
+		else
+			res << setw(40) << "";
+		// bucket b holds latencies below 2^b ms
+		uint64_t total = 0;
+		for (unsigned b = 0; b < NUM_BUCKETS; b++)
+			total += s.latency[b];
+		res << "  ";
+		if (total == 0) {
+			res << "-" << endl;
+			continue;
+		}
+		const double quantiles[] = {0.5, 0.9, 1.0};
+		for (unsigned q = 0; q < 3; q++) {
+			uint64_t sum = 0;
+			unsigned b = 0;
+			for (; b < NUM_BUCKETS - 1; b++) {
+				sum += s.latency[b];
+				if (sum >= quantiles[q] * total)
+					break;
+			}
+			res << (q ? "/" : "") << (b < NUM_BUCKETS - 1 ? "<" : ">=") << (b < NUM_BUCKETS - 1 ? (1u << b) : (1u << (b - 1)));
+		}
+		res << endl;
+	}
+	return res.str();
+}
+
+// cpu/node list like "0-3,8,10-11"
+static vector<unsigned> ParseCpuList(const string& aList) {
+	vector<unsigned> res;
+	stringstream in(aList);
+	string range;
+	while (getline(in, range, ',')) {
+		if (range.find_first_of("0123456789") == string::npos)
+			continue;
+		size_t dash = range.find('-');
+		unsigned first = stream_cast<unsigned>(range.substr(0, dash));
+		unsigned last = dash == string::npos ? first : stream_cast<unsigned>(range.substr(dash + 1));
+		for (unsigned c = first; c <= last; c++)
+			res.push_back(c);
+	}
+	return res;
+}
+
+numa_topology::numa_topology() : sysfs(false) {
+	vector<unsigned> allowed;
+#ifdef __linux__
+	cpu_set_t mask;
+	CPU_ZERO(&mask);
+	if (sched_getaffinity(0, sizeof(mask), &mask) == 0)
+		for (unsigned c = 0; c < CPU_SETSIZE; c++)
+			if (CPU_ISSET(c, &mask))
+				allowed.push_back(c);
+
+	string online;
+	ifstream fin("/sys/devices/system/node/online");
+	getline(fin, online);
+	vector<unsigned> nodes = ParseCpuList(online);
+	for (unsigned i = 0; i < nodes.size(); i++) {
+		string list;
+		ifstream fcpu(("/sys/devices/system/node/node" + stream_cast<string>(nodes[i]) + "/cpulist").c_str());
+		getline(fcpu, list);
+		vector<unsigned> nodeCpus = ParseCpuList(list);
+		vector<unsigned> usable;
+		for (unsigned c = 0; c < nodeCpus.size(); c++)
+			if (std::find(allowed.begin(), allowed.end(), nodeCpus[c]) != allowed.end())
+				usable.push_back(nodeCpus[c]);
+		if (usable.empty())
+			continue;
+		cpus.push_back(usable);
+		ids.push_back(nodes[i]);
+	}
+	sysfs = !cpus.empty();
+#endif
+	if (cpus.empty()) {
+		if (allowed.empty())
+			for (unsigned c = 0; c < std::max(1u, std::thread::hardware_concurrency()); c++)
+				allowed.push_back(c);
+		cpus.push_back(allowed);
+		ids.push_back(0);
+	}
+}
+
+bool numa_topology::pin(std::thread::native_handle_type aThread, const vector<unsigned>& aCpus) {
+#ifdef __linux__
+	cpu_set_t mask;
+	CPU_ZERO(&mask);
+	for (unsigned c = 0; c < aCpus.size(); c++)
+		CPU_SET(aCpus[c], &mask);
+	return pthread_setaffinity_np(aThread, sizeof(mask), &mask) == 0;
+#else
+	return false;
+#endif
+}
+
+// modes of set_mempolicy(2)
+static const int MEMPOLICY_DEFAULT = 0;
+static const int MEMPOLICY_PREFERRED = 1;
+static const int MEMPOLICY_INTERLEAVE = 3;
 
+bool numa_topology::set_policy(int aMode, const vector<unsigned>& aNodes) const {
+#ifdef __linux__
+	if (!sysfs)
+		return false;
+	unsigned maxId = *std::max_element(aNodes.begin(), aNodes.end());
+	vector<unsigned long> mask(maxId / (8 * sizeof(unsigned long)) + 1, 0);
+	for (unsigned i = 0; i < aNodes.size(); i++)
+		mask[aNodes[i] / (8 * sizeof(unsigned long))] |= 1UL << (aNodes[i] % (8 * sizeof(unsigned long)));
+	return syscall(SYS_set_mempolicy, aMode, mask.data(), mask.size() * 8 * sizeof(unsigned long) + 1) == 0;
+#else
+	return false;
+#endif
+}
+
+bool numa_topology::bind_memory(unsigned aNode) const {
+	return set_policy(MEMPOLICY_PREFERRED, vector<unsigned>(1, ids[aNode]));
+}
+
+bool numa_topology::interleave_memory() const {
+	return set_policy(MEMPOLICY_INTERLEAVE, ids);
+}
+
+void numa_topology::default_memory() {
+#ifdef __linux__
+	syscall(SYS_set_mempolicy, MEMPOLICY_DEFAULT, NULL, 0);
+#endif
+}
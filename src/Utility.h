@@ -31,10 +31,10 @@
 #include <mutex>
 #include <atomic>
 #include <chrono>
-
-#ifdef USEMULTITHREAD
-#include <omp.h>
-#endif
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <exception>
 
 //#include "vectors.h"
 
@@ -117,6 +117,93 @@ inline int IntHash(int key, int aModulo, unsigned aSeed) {
 	return IntHashSimple(key * (aSeed + 1) * A, aModulo);
 }
 
+//Return a well mixed 32 bit hash value of key (murmur3 finalizer), aSeed selects the hash function
+inline unsigned IntHashMix(unsigned key, unsigned aSeed) {
+	key ^= aSeed * 0x9E3779B9;
+	key ^= key >> 16;
+	key *= 0x85EBCA6B;
+	key ^= key >> 13;
+	key *= 0xC2B2AE35;
+	key ^= key >> 16;
+	return key;
+}
+
+//------------------------------------------------------------------------------------------------------------------------
+enum HashFamilyType {
+	LEGACY_HASH, MULTIPLY_SHIFT, TABULATION
+};
+
+///Family of integer hash functions for the MinHash keys, seeded from the random seed.
+///Hash() evaluates a block of functions of the family for one key; the parameters are
+///stored function-minor so that the loop over the functions is vectorized.
+class IntHashFamily {
+public:
+	IntHashFamily();
+	void Init(HashFamilyType aFamily, unsigned aNumFunctions, unsigned aHashBitSize, unsigned aRandomSeed);
+	void Hash(unsigned key, unsigned aFirst, unsigned aNum, unsigned* oKeys) const;
+private:
+	HashFamilyType mFamily;
+	unsigned mNumFunctions;
+	unsigned mHashBitMask;
+	unsigned mShift;
+	vector<unsigned> mMul;		// multiply-shift, odd multipliers
+	vector<unsigned> mAdd;
+	vector<unsigned> mTable;	// tabulation, 4 x 256 x mNumFunctions
+};
+
+//Keys of the functions aFirst..aFirst+aNum-1 for key, LEGACY_HASH gives the same keys as
+//IntHash(key, mask, aFirst+1..), the others take the high bits of a 32 bit hash value
+inline void IntHashFamily::Hash(unsigned key, unsigned aFirst, unsigned aNum, unsigned* oKeys) const {
+	if (mFamily == MULTIPLY_SHIFT) {
+		const unsigned* a = mMul.data() + aFirst;
+		const unsigned* b = mAdd.data() + aFirst;
+		for (unsigned l = 0; l < aNum; l++)
+			oKeys[l] = (a[l] * key + b[l]) >> mShift;
+	} else if (mFamily == TABULATION) {
+		const unsigned n = mNumFunctions;
+		const unsigned* t0 = mTable.data() + ((key & 0xFF)) * n + aFirst;
+		const unsigned* t1 = mTable.data() + (256 + ((key >> 8) & 0xFF)) * n + aFirst;
+		const unsigned* t2 = mTable.data() + (512 + ((key >> 16) & 0xFF)) * n + aFirst;
+		const unsigned* t3 = mTable.data() + (768 + (key >> 24)) * n + aFirst;
+		for (unsigned l = 0; l < aNum; l++)
+			oKeys[l] = (t0[l] ^ t1[l] ^ t2[l] ^ t3[l]) >> mShift;
+	} else {
+		for (unsigned l = 0; l < aNum; l++)
+			oKeys[l] = IntHash(key, mHashBitMask, aFirst + l + 1);
+	}
+}
+
+//Return a 128 bit hash of a string, used as content key where collisions must be negligible
+inline pair<uint64_t, uint64_t> StringHash128(const string& aStr) {
+	const uint64_t C1 = 0x87C37B91114253D5ULL;
+	const uint64_t C2 = 0x4CF5AD432745937FULL;
+	uint64_t h1 = 0x9E3779B97F4A7C15ULL ^ aStr.size();
+	uint64_t h2 = 0xC2B2AE3D27D4EB4FULL ^ (aStr.size() * C1);
+	const char* p = aStr.data();
+	size_t n = aStr.size();
+	while (n > 0) {
+		uint64_t k = 0;
+		size_t len = n < 8 ? n : 8;
+		memcpy(&k, p, len);
+		p += len;
+		n -= len;
+		h1 ^= k * C1;
+		h1 = ((h1 << 27) | (h1 >> 37)) * 5 + 0x52DCE729;
+		h2 ^= ((k << 31) | (k >> 33)) * C2;
+		h2 = ((h2 << 31) | (h2 >> 33)) * 5 + 0x38495AB5;
+		h2 += h1;
+	}
+	// 64 bit finalizer (splitmix64) on both halves
+	for (uint64_t* h : {&h1, &h2}) {
+		*h ^= *h >> 30;
+		*h *= 0xBF58476D1CE4E5B9ULL;
+		*h ^= *h >> 27;
+		*h *= 0x94D049BB133111EBULL;
+		*h ^= *h >> 31;
+	}
+	return make_pair(h1, h2 ^ h1);
+}
+
 //unsigned RSHash(const string& str);
 //unsigned RSHash(const vector<unsigned>& aV);
 //unsigned APHash(const string& str);
@@ -237,6 +324,22 @@ public:
 	string GetFullPathFileName();
 };
 
+// input buffer over the bytes [begin,end) of a file, so that several readers can
+// parse separate parts of one uncompressed file
+class FileRangeBuf : public std::streambuf {
+public:
+	FileRangeBuf():mFile(NULL),mLeft(0) {};
+	~FileRangeBuf() { close(); };
+	bool open(const string& aFileName, uint64_t aBegin, uint64_t aEnd);
+	void close();
+protected:
+	int_type underflow();
+private:
+	FILE*		mFile;
+	uint64_t	mLeft;
+	char		mBuf[1 << 16];
+};
+
 
 //-------------------------------------------------------------------------------------------------------------------------
 
@@ -309,6 +412,377 @@ public:
 
 };
 
+// size of the next work chunk in bases, chosen so that one worker needs about the target
+// time for it; the workers report bases and time of each finished chunk, the estimated
+// throughput is a moving average over these reports
+class adaptive_chunker
+{
+private:
+	mutable std::mutex mut;
+	uint64_t min_size;
+	uint64_t max_size;
+	double target_ns;		// 0 keeps all chunks at min_size
+	double rate;			// bases per ns of one worker, 0 until the first estimate
+	uint64_t fed_size;		// reports not yet in rate
+	uint64_t fed_ns;
+	uint64_t num_chunks;	// statistics of the chunks made
+	uint64_t sum_size;
+	uint64_t smallest;
+	uint64_t largest;
+	uint64_t last_size;
+public:
+	adaptive_chunker() { init(1,1,0); }
+	void init(uint64_t aMinSize, uint64_t aMaxSize, unsigned aTargetMs);
+	uint64_t next_size() const;
+	void record(uint64_t aSize);
+	void report(uint64_t aSize, uint64_t aNs);
+	string stats() const;
+};
+
+// map shared by threads with a memory bound, split into shards with their own lock; each shard
+// keeps two generations of entries, when the current one is full it replaces the old one, hits in
+// the old generation are moved to the current one (approximates LRU without per entry bookkeeping).
+// An entry counts its key, value and map node plus the heap bytes S reports for the value
+template<typename K, typename V, typename H, typename S>
+class threadsafe_cache
+{
+private:
+	typedef std::tr1::unordered_map<K, V, H> mapT;
+	struct shardS {
+		std::mutex mut;
+		mapT cur;
+		mapT old;
+		size_t curBytes;
+		size_t oldBytes;
+		shardS() : curBytes(0), oldBytes(0) {}
+	};
+	std::unique_ptr<shardS[]> shards;
+	unsigned numShards;
+	size_t shardBytes;	// per generation
+	H hasher;
+	S valueBytes;
+public:
+	std::atomic<unsigned long> hits;
+	std::atomic<unsigned long> misses;
+
+	threadsafe_cache(size_t aCapacityBytes = 0, unsigned aNumShards = 64) :
+		shards(new shardS[aNumShards]), numShards(aNumShards), shardBytes(std::max((size_t) 1, aCapacityBytes / aNumShards / 2)), hits(0), misses(0)
+	{}
+
+	size_t capacity() const
+	{
+		return shardBytes * 2 * numShards;
+	}
+
+	// bytes held by the entries and the bucket arrays
+	size_t bytes()
+	{
+		size_t b = 0;
+		for (unsigned i = 0; i < numShards; i++) {
+			std::lock_guard<std::mutex> lk(shards[i].mut);
+			b += shards[i].curBytes + shards[i].oldBytes + (shards[i].cur.bucket_count() + shards[i].old.bucket_count()) * sizeof(void*);
+		}
+		return b;
+	}
+
+	bool find(const K& key, V& value)
+	{
+		// shard from the high bits, the maps use the low ones
+		shardS& s = shards[(hasher(key) >> 24) % numShards];
+		std::lock_guard<std::mutex> lk(s.mut);
+		typename mapT::iterator it = s.cur.find(key);
+		if (it != s.cur.end()) {
+			value = it->second;
+			hits++;
+			return true;
+		}
+		it = s.old.find(key);
+		if (it != s.old.end()) {
+			value = it->second;
+			s.oldBytes -= entry_bytes(it->second);
+			s.old.erase(it);
+			insert_locked(s, key, value);
+			hits++;
+			return true;
+		}
+		misses++;
+		return false;
+	}
+
+	void insert(const K& key, const V& value)
+	{
+		shardS& s = shards[(hasher(key) >> 24) % numShards];
+		std::lock_guard<std::mutex> lk(s.mut);
+		insert_locked(s, key, value);
+	}
+
+private:
+	size_t entry_bytes(const V& value) const
+	{
+		return sizeof(K) + sizeof(V) + 2 * sizeof(void*) + valueBytes(value);
+	}
+
+	void insert_locked(shardS& s, const K& key, const V& value)
+	{
+		typename mapT::iterator it = s.cur.find(key);
+		if (it != s.cur.end()) {
+			s.curBytes -= entry_bytes(it->second);
+			s.cur.erase(it);
+		}
+		size_t e = entry_bytes(value);
+		if (s.curBytes + e > shardBytes && !s.cur.empty()) {
+			s.old.swap(s.cur);
+			s.oldBytes = s.curBytes;
+			s.cur.clear();
+			s.curBytes = 0;
+		}
+		V& stored = s.cur[key];
+		stored = value;
+		s.curBytes += entry_bytes(stored);
+	}
+};
+
+// work-stealing scheduler over a fixed number of threads; every thread has its own deque, it
+// pushes and pops its tasks at the back (newest first, their data is still in the cache) and an
+// idle thread steals from the front of the other deques (oldest first). Tasks submitted from
+// outside the pool are spread over the deques. Tasks must not wait for each other: a stage that
+// cannot go on returns and is submitted again by the task that lets it go on.
+class task_pool
+{
+public:
+	typedef std::function<void()> taskT;
+
+	explicit task_pool(unsigned aNumThreads = 0);	// 0 uses the hardware concurrency
+	~task_pool();
+
+	unsigned size() const { return numThreads; }
+	// index of the calling pool thread, size() for other threads
+	unsigned thread_index() const;
+	void submit(taskT aTask);
+	// runs aTask on pool thread aIndex, the other threads do not steal it
+	void submit_to(unsigned aIndex, taskT aTask);
+	// blocks until no task is left, rethrows the first exception of a task;
+	// tasks still queued after an exception are dropped
+	void wait();
+	// pins pool thread aIndex to cpu aCpu
+	bool pin(unsigned aIndex, unsigned aCpu);
+	// tasks waiting in the deques, and the time the threads slept without a task
+	long num_queued();
+	uint64_t idle_ns();
+	// runs f(i) for i in [aBegin,aEnd) in blocks of aGrain and waits for them, not from a pool thread
+	template<typename F>
+	void parallel_for(size_t aBegin, size_t aEnd, size_t aGrain, F f)
+	{
+		aGrain = std::max((size_t) 1, aGrain);
+		for (size_t b = aBegin; b < aEnd; b += aGrain) {
+			size_t e = std::min(aEnd, b + aGrain);
+			submit([f,b,e]{ for (size_t i = b; i < e; i++) f(i); });
+		}
+		wait();
+	}
+
+private:
+	struct dequeS {
+		std::mutex mut;
+		std::deque<taskT> tasks;
+		std::deque<taskT> own;		// tasks of submit_to, only for this thread
+		long numOwn;				// size of own, guarded by mut of the pool
+		dequeS() : numOwn(0) {}
+	};
+	unsigned numThreads;
+	std::unique_ptr<dequeS[]> deques;
+	vector<thread> threads;
+	std::atomic<unsigned> next;		// deque for the next task from outside
+	std::mutex mut;
+	std::condition_variable task_cond;
+	std::condition_variable done_cond;
+	long queued;					// tasks in the deques, guarded by mut (-1 while a task is taken before it is counted)
+	std::atomic<size_t> pending;	// tasks submitted and not finished
+	unsigned sleeping;				// threads waiting for a task, guarded by mut like the next two
+	uint64_t idle;					// sleeping threads x ns up to lastChange
+	std::chrono::steady_clock::time_point lastChange;
+	std::atomic<bool> failed;
+	std::exception_ptr error;
+	bool stop;
+
+	static thread_local task_pool* current;
+	static thread_local unsigned current_index;
+
+	void run(unsigned aIndex);
+	void count_sleeping(int aChange);
+	bool take(unsigned aIndex, taskT& oTask);
+};
+
+// stage that must not run in parallel (index update, output) without a thread of its own:
+// push() queues an item and the thread that finds the stage idle runs f on all queued items,
+// the other threads return at once
+template<typename T>
+class serial_stage
+{
+private:
+	std::mutex mut;
+	std::deque<T> items;
+	std::atomic<bool> busy;
+
+	bool pop(T& value)
+	{
+		std::lock_guard<std::mutex> lk(mut);
+		if (items.empty())
+			return false;
+		value = std::move(items.front());
+		items.pop_front();
+		return true;
+	}
+
+public:
+	serial_stage():busy(false) {}
+
+	template<typename F>
+	void push(T value, F f)
+	{
+		{
+			std::lock_guard<std::mutex> lk(mut);
+			items.push_back(std::move(value));
+		}
+		while (!busy.exchange(true)) {
+			T item;
+			while (pop(item))
+				f(item);
+			busy.store(false);
+			// an item pushed after the last pop found the stage busy, take it over
+			std::lock_guard<std::mutex> lk(mut);
+			if (items.empty())
+				return;
+		}
+	}
+
+	size_t size()
+	{
+		std::lock_guard<std::mutex> lk(mut);
+		return items.size();
+	}
+};
+
+// recycled objects shared between threads; put() takes back an object nobody else holds
+// anymore, clears it and keeps it with its buffers for the next get()
+template<typename T>
+class object_pool
+{
+private:
+	std::mutex mut;
+	vector<std::shared_ptr<T> > free;
+	std::atomic<uint64_t> created;
+	std::atomic<uint64_t> reused;
+
+public:
+	object_pool():created(0),reused(0) {}
+
+	std::shared_ptr<T> get()
+	{
+		{
+			std::lock_guard<std::mutex> lk(mut);
+			if (!free.empty()) {
+				std::shared_ptr<T> obj = std::move(free.back());
+				free.pop_back();
+				reused++;
+				return obj;
+			}
+		}
+		created++;
+		return std::make_shared<T>();
+	}
+
+	void put(std::shared_ptr<T>& obj)
+	{
+		if (obj && obj.use_count() == 1) {
+			obj->clear();
+			std::lock_guard<std::mutex> lk(mut);
+			free.push_back(std::move(obj));
+		}
+		obj.reset();
+	}
+
+	uint64_t num_created() const { return created; }
+	uint64_t num_reused() const { return reused; }
+};
+
+// NUMA nodes with the cpus the process may run on, read from /sys; without the sysfs tree all
+// cpus form one node. The memory policies are set with the set_mempolicy system call, so
+// libnuma is not needed; they apply to pages the calling thread touches first from then on
+class numa_topology
+{
+public:
+	numa_topology();
+	unsigned num_nodes() const { return cpus.size(); }
+	const vector<unsigned>& node_cpus(unsigned aNode) const { return cpus[aNode]; }
+	static bool pin(std::thread::native_handle_type aThread, const vector<unsigned>& aCpus);
+	// calling thread: takes new memory from aNode
+	bool bind_memory(unsigned aNode) const;
+	// calling thread: new memory is spread over all nodes
+	bool interleave_memory() const;
+	static void default_memory();
+private:
+	vector<vector<unsigned> > cpus;	// per node
+	vector<unsigned> ids;			// node numbers of the kernel
+	bool sysfs;
+	bool set_policy(int aMode, const vector<unsigned>& aNodes) const;
+};
+
+// counters of the stages of one pipeline run, updated by the tasks: busy is the time spent in
+// a stage, wait_in the time its items waited in front of it, wait_out the time it was held up
+// by a later stage; each stage and the whole pipeline (from read to done) keep a histogram of
+// the item latencies in log2 ms buckets. With a stats file a sampler thread writes the
+// counters and the gauges (queue depths) as one tab separated line per interval
+class pipeline_stats
+{
+public:
+	static const unsigned NUM_BUCKETS = 16;	// <1ms, 1-2ms, ..., >=16s
+	typedef std::chrono::steady_clock clockT;
+	typedef std::function<uint64_t()> gaugeT;
+
+	explicit pipeline_stats(const vector<string>& aStages);
+	~pipeline_stats();
+
+	void add_gauge(const string& aName, gaugeT aGauge);
+	// starts the clock and the sampler, the first run truncates the file, later runs append to it
+	void start(const string& aFileName, unsigned aIntervalMs, unsigned aRun);
+	// stops the clock, writes the last line and the latency histograms
+	void stop();
+
+	void busy(unsigned aStage, clockT::time_point aStart, clockT::time_point aEnd, clockT::time_point aQueued);
+	void wait_out(unsigned aStage, uint64_t aNs) { stages[aStage].wait_out_ns += aNs; }
+	void done(clockT::time_point aCreated);
+	static uint64_t ns(clockT::time_point aFrom, clockT::time_point aTo);
+
+	string summary(unsigned aNumThreads, uint64_t aIdleNs) const;
+
+private:
+	struct stageS {
+		string name;
+		std::atomic<uint64_t> items;
+		std::atomic<uint64_t> busy_ns;
+		std::atomic<uint64_t> wait_in_ns;
+		std::atomic<uint64_t> wait_out_ns;
+		std::atomic<uint64_t> latency[NUM_BUCKETS];
+		stageS():items(0),busy_ns(0),wait_in_ns(0),wait_out_ns(0) { for (unsigned b = 0; b < NUM_BUCKETS; b++) latency[b] = 0; }
+	};
+	std::unique_ptr<stageS[]> stages;	// the last one is the whole pipeline
+	unsigned numStages;
+	vector<pair<string, gaugeT> > gauges;
+	clockT::time_point begin;
+	clockT::time_point finish;		// set by stop()
+	ofstream out;
+	unsigned run;
+	thread sampler;
+	std::mutex mut;
+	std::condition_variable cond;
+	bool stopping;
+
+	static void add_latency(stageS& aStage, uint64_t aNs);
+	static string latency_line(const stageS& aStage);
+	void sample();
+};
+
 class join_threads
 {
 	vector<thread>& threads;
@@ -133,6 +133,318 @@ int gzstreambuf::sync() {
     return 0;
 }
 
+// --------------------------------------
+// class pgzstreambuf:
+// --------------------------------------
+
+int pgzstreambuf::maxThreads = 0;
+
+pgzstreambuf* pgzstreambuf::open( const char* name, int numThreads) {
+    if ( is_open())
+        return (pgzstreambuf*)0;
+    fh = strcmp( name, "-") == 0 ? stdin : fopen( name, "rb");
+    if ( fh == 0)
+        return (pgzstreambuf*)0;
+    // a BGZF block is a gzip member with a 'BC' extra subfield that holds the block size;
+    // the header bytes are kept instead of seeking back, so that pipes can be read
+    unsigned char h[18];
+    size_t n = fread( h, 1, 18, fh);
+    gzip = n >= 2 && h[0] == 0x1f && h[1] == 0x8b;
+    bgzf = gzip && n == 18 && (h[3] & 4) && h[10] == 6 && h[11] == 0
+        && h[12] == 'B' && h[13] == 'C' && h[14] == 2 && h[15] == 0;
+    head.assign( (const char*) h, n);
+    headPos = 0;
+
+    if ( numThreads <= 0)
+        numThreads = maxThreads;
+    if ( numThreads <= 0)
+        numThreads = std::max( 1u, std::min( 4u, std::thread::hardware_concurrency()));
+    nextSeq = 0;
+    numSeq = 0;
+    maxInFlight = 2 * numThreads + 2;
+    sourceDone = false;
+    failed = false;
+    stop = false;
+    current.reset();
+    setg( 0, 0, 0);
+    opened = 1;
+    threads.push_back( std::thread( &pgzstreambuf::readAhead, this));
+    if ( bgzf)
+        for ( int i = 0; i < numThreads; i++)
+            threads.push_back( std::thread( &pgzstreambuf::inflateBlocks, this));
+    return this;
+}
+
+pgzstreambuf * pgzstreambuf::close() {
+    if ( ! is_open())
+        return (pgzstreambuf*)0;
+    {
+        std::lock_guard<std::mutex> lk( mut);
+        stop = true;
+    }
+    cv_work.notify_all();
+    cv_done.notify_all();
+    for ( size_t i = 0; i < threads.size(); i++)
+        threads[i].join();
+    threads.clear();
+    jobs.clear();
+    done.clear();
+    spare.clear();
+    current.reset();
+    setg( 0, 0, 0);
+    if ( fh != stdin)
+        fclose( fh);
+    fh = 0;
+    opened = 0;
+    return failed ? (pgzstreambuf*)0 : this;
+}
+
+int pgzstreambuf::underflow() {
+    if ( gptr() && ( gptr() < egptr()))
+        return * reinterpret_cast<unsigned char *>( gptr());
+    if ( ! opened)
+        return EOF;
+
+    std::unique_lock<std::mutex> lk( mut);
+    do {
+        cv_done.wait( lk, [this]{ return stop || failed || done.count( nextSeq)
+            || ( sourceDone && nextSeq == numSeq); });
+        std::map<uint64_t,chunkP>::iterator it = done.find( nextSeq);
+        if ( it == done.end())
+            return EOF;
+        if ( current && spare.size() < maxInFlight)
+            spare.push_back( current);
+        current = it->second;
+        done.erase( it);
+        nextSeq++;
+        cv_work.notify_all(); // room for the read-ahead thread
+    } while ( current->empty());
+    lk.unlock();
+
+    setg( &(*current)[0], &(*current)[0], &(*current)[0] + current->size());
+    return * reinterpret_cast<unsigned char *>( gptr());
+}
+
+size_t pgzstreambuf::readSource( char* dest, size_t n) {
+    size_t fromHead = std::min( n, head.size() - headPos);
+    memcpy( dest, head.data() + headPos, fromHead);
+    headPos += fromHead;
+    if ( fromHead == n)
+        return n;
+    return fromHead + fread( dest + fromHead, 1, n - fromHead, fh);
+}
+
+bool pgzstreambuf::waitForSpace() {
+    std::unique_lock<std::mutex> lk( mut);
+    cv_work.wait( lk, [this]{ return stop || numSeq - nextSeq < maxInFlight; });
+    return ! stop;
+}
+
+pgzstreambuf::chunkP pgzstreambuf::newChunk( size_t size) {
+    chunkP chunk;
+    {
+        std::lock_guard<std::mutex> lk( mut);
+        if ( ! spare.empty()) {
+            chunk = spare.back();
+            spare.pop_back();
+        }
+    }
+    if ( ! chunk)
+        chunk = std::make_shared<std::vector<char> >();
+    chunk->resize( size);
+    return chunk;
+}
+
+void pgzstreambuf::deliver( uint64_t seq, const chunkP& chunk) {
+    std::lock_guard<std::mutex> lk( mut);
+    done[seq] = chunk;
+    cv_done.notify_all();
+}
+
+void pgzstreambuf::fail() {
+    std::lock_guard<std::mutex> lk( mut);
+    failed = true;
+    cv_work.notify_all();
+    cv_done.notify_all();
+}
+
+void pgzstreambuf::readAhead() {
+    if ( bgzf) {
+        // whole blocks are batched into jobs for the inflater threads
+        unsigned char h[18];
+        for (;;) {
+            chunkP batch = std::make_shared<std::vector<char> >();
+            batch->reserve( batchSize + (1 << 16));
+            while ( batch->size() < (size_t)batchSize) {
+                size_t n = readSource( (char*) h, 18);
+                if ( n == 0)
+                    break;
+                size_t bsize = (h[16] | (h[17] << 8)) + 1;
+                if ( n < 18 || h[0] != 0x1f || h[1] != 0x8b || h[12] != 'B' || h[13] != 'C' || bsize < 26) {
+                    fail();
+                    return;
+                }
+                size_t pos = batch->size();
+                batch->resize( pos + bsize);
+                memcpy( &(*batch)[pos], h, 18);
+                if ( readSource( &(*batch)[pos + 18], bsize - 18) != bsize - 18) {
+                    fail();
+                    return;
+                }
+            }
+            if ( batch->empty())
+                break;
+            if ( ! waitForSpace())
+                return;
+            std::lock_guard<std::mutex> lk( mut);
+            jobS job;
+            job.seq = numSeq++;
+            job.data = batch;
+            jobs.push_back( job);
+            cv_work.notify_all();
+        }
+    } else if ( gzip) {
+        // a single stream can only be inflated in order, but ahead of the reader
+        z_stream zs;
+        memset( &zs, 0, sizeof( zs));
+        if ( inflateInit2( &zs, 15 + 16) != Z_OK) {
+            fail();
+            return;
+        }
+        std::vector<char> in( batchSize);
+        chunkP out;
+        bool member = true;     // inside a gzip member
+        bool ok = true;
+        for (;;) {
+            if ( zs.avail_in == 0) {
+                zs.avail_in = readSource( &in[0], in.size());
+                zs.next_in = (Bytef*) &in[0];
+                if ( zs.avail_in == 0) {
+                    ok = ! member;
+                    break;
+                }
+            }
+            if ( ! member) {
+                // further members are concatenated, other trailing data is ignored as gzread does
+                if ( zs.next_in[0] != 0x1f)
+                    break;
+                inflateReset( &zs);
+                member = true;
+            }
+            if ( ! out) {
+                out = newChunk( chunkSize);
+                zs.next_out = (Bytef*) &(*out)[0];
+                zs.avail_out = chunkSize;
+            }
+            int ret = inflate( &zs, Z_NO_FLUSH);
+            if ( ret == Z_STREAM_END)
+                member = false;
+            else if ( ret != Z_OK && ret != Z_BUF_ERROR) {
+                ok = false;
+                break;
+            }
+            if ( zs.avail_out == 0) {
+                if ( ! waitForSpace()) {
+                    inflateEnd( &zs);
+                    return;
+                }
+                std::lock_guard<std::mutex> lk( mut);
+                done[numSeq++] = out;
+                cv_done.notify_all();
+                out.reset();
+            }
+        }
+        if ( out && waitForSpace()) {
+            out->resize( chunkSize - zs.avail_out);
+            std::lock_guard<std::mutex> lk( mut);
+            done[numSeq++] = out;
+        }
+        inflateEnd( &zs);
+        if ( ! ok)
+            fail();
+    } else {
+        for (;;) {
+            chunkP out = newChunk( chunkSize);
+            size_t n = readSource( &(*out)[0], chunkSize);
+            if ( n == 0 || ! waitForSpace())
+                break;
+            out->resize( n);
+            std::lock_guard<std::mutex> lk( mut);
+            done[numSeq++] = out;
+            cv_done.notify_all();
+        }
+    }
+    std::lock_guard<std::mutex> lk( mut);
+    sourceDone = true;
+    cv_work.notify_all();
+    cv_done.notify_all();
+}
+
+void pgzstreambuf::inflateBlocks() {
+    z_stream zs;
+    memset( &zs, 0, sizeof( zs));
+    if ( inflateInit2( &zs, 15 + 16) != Z_OK) {
+        fail();
+        return;
+    }
+    for (;;) {
+        jobS job;
+        {
+            std::unique_lock<std::mutex> lk( mut);
+            cv_work.wait( lk, [this]{ return stop || failed || sourceDone || ! jobs.empty(); });
+            if ( stop || failed || jobs.empty())
+                break;
+            job = jobs.front();
+            jobs.pop_front();
+        }
+        // every block is a complete gzip member that ends with its inflated size
+        const std::vector<char>& in = *job.data;
+        const unsigned char* p = (const unsigned char*) &in[0];
+        size_t total = 0;
+        for ( size_t pos = 0; pos < in.size(); pos += (p[pos+16] | (p[pos+17] << 8)) + 1) {
+            size_t end = pos + (p[pos+16] | (p[pos+17] << 8)) + 1;
+            total += p[end-4] | (p[end-3] << 8) | (p[end-2] << 16) | ((size_t)p[end-1] << 24);
+        }
+        chunkP out = newChunk( total);
+        char empty;
+        size_t outPos = 0;
+        bool ok = true;
+        for ( size_t pos = 0; pos < in.size() && ok; ) {
+            size_t bsize = (p[pos+16] | (p[pos+17] << 8)) + 1;
+            size_t isize = p[pos+bsize-4] | (p[pos+bsize-3] << 8) | (p[pos+bsize-2] << 16) | ((size_t)p[pos+bsize-1] << 24);
+            inflateReset( &zs);
+            zs.next_in = (Bytef*) &p[pos];
+            zs.avail_in = bsize;
+            zs.next_out = (Bytef*) ( isize ? &(*out)[outPos] : &empty);
+            zs.avail_out = isize;
+            ok = inflate( &zs, Z_FINISH) == Z_STREAM_END && zs.avail_out == 0;
+            outPos += isize;
+            pos += bsize;
+        }
+        if ( ! ok) {
+            fail();
+            break;
+        }
+        deliver( job.seq, out);
+    }
+    inflateEnd( &zs);
+}
+
+// --------------------------------------
+// class pgzstreambase:
+// --------------------------------------
+
+void pgzstreambase::open( const char* name, int open_mode, int numThreads) {
+    if ( ! ( open_mode & std::ios::in) || ! buf.open( name, numThreads))
+        clear( rdstate() | std::ios::badbit);
+}
+
+void pgzstreambase::close() {
+    if ( buf.is_open())
+        if ( ! buf.close())
+            clear( rdstate() | std::ios::badbit);
+}
+
 // --------------------------------------
 // class gzstreambase:
 // --------------------------------------
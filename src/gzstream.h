@@ -32,6 +32,16 @@
 // standard C++ with new header file names and std:: namespace
 #include <iostream>
 #include <fstream>
+#include <string>
+#include <cstdio>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <stdint.h>
 #include <zlib.h>
 
 #ifdef GZSTREAM_NAMESPACE
@@ -71,6 +81,74 @@ public:
     virtual int     sync();
 };
 
+// Input buffer that decompresses ahead of the reader in large chunks. BGZF files
+// (blocked gzip, e.g. written by bgzip) are inflated block-wise on a pool of
+// threads, other gzip files (also multi-member) and plain files are read ahead
+// by one thread. The inflaters of a stream are the numThreads of open, maxThreads if
+// it is 0; the read-ahead thread comes on top. Chunks are always delivered in file order. The name "-" reads stdin; pipes
+// work as well, the file is read strictly forward.
+class pgzstreambuf : public std::streambuf {
+public:
+    static const int chunkSize = 4 << 20;       // bytes per read-ahead chunk
+    static const int batchSize = 1 << 20;       // compressed bytes per BGZF job
+    static int       maxThreads;                // default inflaters, 0 is min(4, hardware concurrency)
+
+    pgzstreambuf() : opened(0), fh(0) { setg( 0, 0, 0); }
+    int is_open() { return opened; }
+    pgzstreambuf* open( const char* name, int numThreads = 0);
+    pgzstreambuf* close();
+    ~pgzstreambuf() { close(); }
+
+    virtual int     underflow();
+private:
+    typedef std::shared_ptr<std::vector<char> > chunkP;
+    struct jobS {
+        uint64_t seq;
+        chunkP   data;  // compressed BGZF blocks
+    };
+
+    char             opened;
+    FILE*            fh;
+    bool             bgzf;
+    bool             gzip;
+    chunkP           current;       // chunk in the get area
+
+    std::vector<std::thread>    threads;
+    std::mutex                  mut;
+    std::condition_variable     cv_work;    // jobs for the inflaters, space for the reader
+    std::condition_variable     cv_done;    // finished chunks for underflow
+    std::deque<jobS>            jobs;
+    std::map<uint64_t,chunkP>   done;
+    std::vector<chunkP>         spare;      // consumed chunks for reuse
+    uint64_t         nextSeq;       // seq of the next chunk for underflow
+    uint64_t         numSeq;        // chunks queued so far
+    unsigned         maxInFlight;
+    bool             sourceDone;
+    bool             failed;
+    bool             stop;
+
+    void readAhead();               // reads the file, inflates gzip streams, queues BGZF jobs
+    void inflateBlocks();           // inflates queued BGZF jobs
+    bool waitForSpace();
+    chunkP newChunk( size_t size);
+    void deliver( uint64_t seq, const chunkP& chunk);
+    void fail();
+    size_t readSource( char* dest, size_t n);   // the peeked header first, then the file
+    std::string      head;          // bytes read by open to detect the format
+    size_t           headPos;
+};
+
+class pgzstreambase : virtual public std::ios {
+protected:
+    pgzstreambuf buf;
+public:
+    pgzstreambase() { init(&buf); }
+    ~pgzstreambase() { buf.close(); }
+    void open( const char* name, int open_mode, int numThreads = 0);
+    void close();
+    pgzstreambuf* rdbuf() { return &buf; }
+};
+
 class gzstreambase : virtual public std::ios {
 protected:
     gzstreambuf buf;
@@ -89,14 +167,14 @@ public:
 // function interface of the zlib. Files are compatible with gzip compression.
 // ----------------------------------------------------------------------------
 
-class igzstream : public gzstreambase, public std::istream {
+class igzstream : public pgzstreambase, public std::istream {
 public:
     igzstream() : std::istream( &buf) {} 
     igzstream( const char* name, int open_mode = std::ios::in)
-        : gzstreambase( name, open_mode), std::istream( &buf) {}  
-    gzstreambuf* rdbuf() { return gzstreambase::rdbuf(); }
-    void open( const char* name, int open_mode = std::ios::in) {
-        gzstreambase::open( name, open_mode);
+        : std::istream( &buf) { pgzstreambase::open( name, open_mode); }
+    pgzstreambuf* rdbuf() { return pgzstreambase::rdbuf(); }
+    void open( const char* name, int open_mode = std::ios::in, int numThreads = 0) {
+        pgzstreambase::open( name, open_mode, numThreads);
     }
 };
 